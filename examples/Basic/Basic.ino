@@ -72,6 +72,12 @@ void loop() {
   // Print them to serial
   printTime(tm, usec);
 
+  // Or format current time in RFC 3339 directly,
+  // e.g. "2020-07-01T08:59:60.123456+09:00" (leap second aware)
+  char buf[RFC3339_BUF_SIZE];
+  pftime::format_rfc3339(buf, sizeof(buf), nullptr, RFC3339_LOCAL | RFC3339_MICROS);
+  Serial.println(buf);
+
   // Get current time as UNIX time
   time_t t = pftime::time(nullptr);
 
@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include <lwip/apps/sntp.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <time.h>
@@ -10,33 +11,45 @@
 #include <esp32-hal.h>
 #endif // ESP32
 #include "ESPPerfectTime.h"
+#include <civil_pt.h>
+#include <fast_pt.h>
+#include <format_pt.h>
+#include <hlc_pt.h>
+#include <hold_pt.h>
+#include <leap_pt.h>
+#include <rec_pt.h>
+#include <sched_pt.h>
 #include <sntp_pt.h>
+#include <stamp_pt.h>
+#include <tz_pt.h>
 
-#define EPOCH_YEAR                   1970
-#define TIME_2020_01_01_00_00_00_UTC 1577836800
 #define SECS_PER_MIN                 60
 #define SECS_PER_HOUR                3600
 #define SECS_PER_DAY                 86400
+#define TIME_GPS_EPOCH_UTC           315964800
+#define TAI_GPS_DIFF                 19
 
-#define IS_LEAP_YEAR(y) ((((y) % 4) == 0 && ((y) % 100) != 0) || ((y) % 400) == 0)
-#define TO_TM_YEAR(m)   ((m) - 1900)
 #define TO_TM_MONTH(m)  ((m) - 1)
 
-static const int _ydays[2][13] = {
-  {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365},
-  {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366}
-};
-
 static uint8_t   _leap_indicator = LI_NO_WARNING;
 static time_t    _leap_time      = 0; // The second of the end of the month -- 23:59:59 in UTC
 static struct tm _tm_result;
+static struct tm _tm_local;
+
+// Reads the system clock (through the fast clock if enabled), corrected by the frequency estimate
+static void readClock(struct timeval *tv) {
+  if (!pftime_fast::read(tv))
+    ::gettimeofday(tv, nullptr);
+  pftime_hold::correct(tv);
+}
 
 uint8_t pftime::getLeapIndicator() {
   if (_leap_indicator == LI_ALARM_CONDITION)
     return LI_ALARM_CONDITION;
 
+  // The same clock as the returned time, so that the leap window matches it
   struct timeval tv;
-  ::gettimeofday(&tv, nullptr);
+  readClock(&tv);
 
   // Actually _leap_indicator doesn't change just after leaping (it will change the next syncing)
   if ((_leap_indicator == LI_LAST_MINUTE_61_SEC && tv.tv_sec > _leap_time + 1) || (_leap_indicator == LI_LAST_MINUTE_59_SEC && tv.tv_sec >= _leap_time))
@@ -52,32 +65,33 @@ static void adjustLeapSec(time_t *t) {
     (*t)++;
 }
 
-static time_t mkgmtime(tm *tm) {
-  size_t is_leap_year = IS_LEAP_YEAR(tm->tm_year) ? 1 : 0;
-  tm->tm_yday         = _ydays[is_leap_year][tm->tm_mon] + tm->tm_mday - 1;
-
-  int    epoch_year;
-  time_t secs_from_epoch;
-  if (tm->tm_year < TO_TM_YEAR(2020)) {
-    epoch_year      = EPOCH_YEAR;
-    secs_from_epoch = 0;
-  } else {
-    // If tm is after 2020-01-01, use pre-calculated UNIX time to be more faster
-    epoch_year      = 2020;
-    secs_from_epoch = TIME_2020_01_01_00_00_00_UTC;
+// Same as adjustLeapSec(), except that it holds 23:59:59 during the inserted leap second
+// and returns true at that time
+static bool adjustLeapSecHold(time_t *t) {
+  if (_leap_indicator == LI_LAST_MINUTE_61_SEC && *t == _leap_time + 1) {
+    *t = _leap_time;
+    return true;
   }
+  adjustLeapSec(t);
+  return false;
+}
 
-  int days = 0;
-  for (int y = epoch_year; TO_TM_YEAR(y) < tm->tm_year; y++)
-    days += IS_LEAP_YEAR(y) ? 366 : 365;
-  days += tm->tm_yday;
+time_t pftime::mkgmtime(struct tm *tm) {
+  // Normalize tm_mon into tm_year
+  int year = tm->tm_year + 1900 + tm->tm_mon / 12;
+  int mon  = tm->tm_mon % 12;
+  if (mon < 0) {
+    mon += 12;
+    year--;
+  }
 
-  secs_from_epoch += days       * SECS_PER_DAY
-                  + tm->tm_hour * SECS_PER_HOUR
-                  + tm->tm_min  * SECS_PER_MIN
-                  + tm->tm_sec;
+  time_t t = (time_t)(pftime_civil::days_from_civil(year, mon + 1, 1) + tm->tm_mday - 1) * SECS_PER_DAY
+           + (time_t)tm->tm_hour * SECS_PER_HOUR
+           + (time_t)tm->tm_min  * SECS_PER_MIN
+           + tm->tm_sec;
 
-  return secs_from_epoch;
+  pftime_civil::to_tm(t, tm);
+  return t;
 }
 
 static time_t calcNextLeapPoint(const time_t current) {
@@ -92,87 +106,260 @@ static time_t calcNextLeapPoint(const time_t current) {
   }
   next_leap.tm_mday = 1;
 
-  return mkgmtime(&next_leap) - 1;
+  return pftime::mkgmtime(&next_leap) - 1;
 }
 
 time_t pftime::time(time_t *timer) {
-#ifdef ESP8266
-  // time() implemented in ESP8266 core is incorrect
-  // so we use gettimeofday() instead of time()
+  // Not ::time(): it would skip the frequency correction in holdover,
+  // and time() implemented in ESP8266 core is incorrect
   // see: https://github.com/esp8266/Arduino/issues/4637
   struct timeval tv;
   pftime::gettimeofday(&tv, nullptr);
   if (timer)
     *timer = tv.tv_sec;
   return tv.tv_sec;
-#else
-  // ESP32's time() is correct
-  time_t t = ::time(nullptr);
-  adjustLeapSec(&t);
-  if (timer)
-    *timer = t;
-  return t;
-#endif
 }
 
-#define DEFINE_FUNC_FOOTIME(name)                                                  \
+// Uses precompiled TZ rules instead of newlib's, unless configTzTime() was given an unsupported string
+static struct tm *localtimeImpl(const time_t *timer) {
+  if (pftime_tz::localtime_r(timer, &_tm_local))
+    return &_tm_local;
+  return ::localtime(timer);
+}
+
+#define DEFINE_FUNC_FOOTIME(name, impl)                                            \
   struct tm *pftime::name(const time_t *timer, suseconds_t *res_usec) {            \
     if (timer)                                                                     \
-      return ::name(timer);                                                        \
+      return impl(timer);                                                          \
                                                                                    \
     struct timeval tv;                                                             \
-    ::gettimeofday(&tv, nullptr);                                                  \
+    readClock(&tv);                                                                \
                                                                                    \
     if (res_usec)                                                                  \
       *res_usec = tv.tv_usec;                                                      \
                                                                                    \
     if (_leap_indicator == LI_LAST_MINUTE_61_SEC && tv.tv_sec == _leap_time + 1) { \
-      _tm_result        = *::name(&_leap_time);                                    \
+      _tm_result        = *impl(&_leap_time);                                      \
       _tm_result.tm_sec = 60;                                                      \
       return &_tm_result;                                                          \
     }                                                                              \
                                                                                    \
     adjustLeapSec(&tv.tv_sec);                                                     \
-    return ::name(&tv.tv_sec);                                                     \
+    return impl(&tv.tv_sec);                                                       \
   }
 
-DEFINE_FUNC_FOOTIME(gmtime);
-DEFINE_FUNC_FOOTIME(localtime);
+DEFINE_FUNC_FOOTIME(gmtime, ::gmtime);
+DEFINE_FUNC_FOOTIME(localtime, localtimeImpl);
+
+/** The date of the last converted entry, reused by following entries on the same day */
+struct batch_cache {
+  long      day;
+  struct tm date;
+};
+
+static inline time_t batchSec(const time_t &t) { return t; }
+static inline time_t batchSec(const struct timeval &tv) { return tv.tv_sec; }
+static inline suseconds_t batchUsec(const time_t &) { return 0; }
+static inline suseconds_t batchUsec(const struct timeval &tv) { return tv.tv_usec; }
+
+static inline void batchStore(struct tm *out, const struct tm &tm, suseconds_t) {
+  *out = tm;
+}
+
+static inline void batchStore(pftime::datetime_t *out, const struct tm &tm, suseconds_t usec) {
+  out->year   = (uint16_t)(tm.tm_year + 1900);
+  out->month  = (uint8_t)(tm.tm_mon + 1);
+  out->day    = (uint8_t)tm.tm_mday;
+  out->hour   = (uint8_t)tm.tm_hour;
+  out->minute = (uint8_t)tm.tm_min;
+  out->second = (uint8_t)tm.tm_sec;
+  out->isdst  = (uint8_t)(tm.tm_isdst > 0 ? 1 : 0);
+  out->usec   = (uint32_t)usec;
+}
+
+static void batchConvert(time_t t, bool local, batch_cache *cache, struct tm *tm) {
+  bool leap_sec = adjustLeapSecHold(&t);
+
+  if (local && !pftime_tz::isset()) {
+    ::localtime_r(&t, tm);
+  } else {
+    int isdst = 0;
+    if (local)
+      t += pftime_tz::offset(t, &isdst);
+
+    long secs;
+    long day = pftime_civil::split_days(t, &secs);
+    if (day != cache->day) {
+      pftime_civil::to_tm(t, &cache->date);
+      cache->day = day;
+    }
+    *tm          = cache->date;
+    tm->tm_hour  = (int)(secs / SECS_PER_HOUR);
+    tm->tm_min   = (int)(secs / SECS_PER_MIN % 60);
+    tm->tm_sec   = (int)(secs % SECS_PER_MIN);
+    tm->tm_isdst = isdst;
+  }
+
+  if (leap_sec)
+    tm->tm_sec = 60;
+}
+
+template <typename In, typename Out>
+static size_t batchConvert(const In *timers, Out *results, size_t count, bool local) {
+  if (timers == nullptr || results == nullptr)
+    return 0;
+
+  batch_cache cache;
+  cache.day = LONG_MIN;
+  for (size_t i = 0; i < count; i++) {
+    struct tm tm;
+    batchConvert(batchSec(timers[i]), local, &cache, &tm);
+    batchStore(&results[i], tm, batchUsec(timers[i]));
+  }
+  return count;
+}
+
+#define DEFINE_FUNC_FOOTIME_BATCH(name, local, in_type, out_type)             \
+  size_t pftime::name(const in_type *timers, out_type *results, size_t count) { \
+    return batchConvert(timers, results, count, local);                         \
+  }
+
+DEFINE_FUNC_FOOTIME_BATCH(gmtime_batch, false, time_t, struct tm);
+DEFINE_FUNC_FOOTIME_BATCH(gmtime_batch, false, time_t, datetime_t);
+DEFINE_FUNC_FOOTIME_BATCH(gmtime_batch, false, struct timeval, struct tm);
+DEFINE_FUNC_FOOTIME_BATCH(gmtime_batch, false, struct timeval, datetime_t);
+DEFINE_FUNC_FOOTIME_BATCH(localtime_batch, true, time_t, struct tm);
+DEFINE_FUNC_FOOTIME_BATCH(localtime_batch, true, time_t, datetime_t);
+DEFINE_FUNC_FOOTIME_BATCH(localtime_batch, true, struct timeval, struct tm);
+DEFINE_FUNC_FOOTIME_BATCH(localtime_batch, true, struct timeval, datetime_t);
+
+// Local time offset from UTC (in seconds, positive to east)
+static long localOffset(time_t t) {
+  if (pftime_tz::isset())
+    return pftime_tz::offset(t, nullptr);
+
+  struct tm tm;
+  ::localtime_r(&t, &tm);
+  time_t local = (time_t)pftime_civil::days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * SECS_PER_DAY
+               + tm.tm_hour * SECS_PER_HOUR
+               + tm.tm_min  * SECS_PER_MIN
+               + tm.tm_sec;
+  return (long)(local - t);
+}
+
+size_t pftime::format_rfc3339(char *buf, size_t len, const struct timeval *tv, int flags) {
+  struct timeval now;
+  bool           leap_sec = false;
+  if (tv == nullptr) {
+    readClock(&now);
+    leap_sec = adjustLeapSecHold(&now.tv_sec);
+    tv       = &now;
+  }
+
+  long offset = (flags & RFC3339_LOCAL) ? localOffset(tv->tv_sec) : 0;
+  return pftime_format::rfc3339(buf, len, tv->tv_sec, tv->tv_usec, leap_sec, offset, flags);
+}
+
+size_t pftime::parse_rfc3339(const char *str, struct timeval *tv, bool *leap_sec) {
+  return pftime_format::parse_rfc3339(str, tv, leap_sec);
+}
+
+static time_t rawToTai(time_t raw) {
+  // Until the next syncing, the system clock keeps counting over the leap second,
+  // so it has the same TAI - UTC as just before the leap
+  if ((_leap_indicator == LI_LAST_MINUTE_61_SEC && raw > _leap_time) || (_leap_indicator == LI_LAST_MINUTE_59_SEC && raw >= _leap_time))
+    return raw + pftime_leap::offset(_leap_time);
+  return raw + pftime_leap::offset(raw);
+}
+
+time_t pftime::tai_time(time_t *timer, suseconds_t *res_usec) {
+  struct timeval tv;
+  readClock(&tv);
+
+  time_t t = rawToTai(tv.tv_sec);
+  if (timer)
+    *timer = t;
+  if (res_usec)
+    *res_usec = tv.tv_usec;
+  return t;
+}
+
+time_t pftime::gps_time(time_t *timer, suseconds_t *res_usec) {
+  time_t t = pftime::tai_time(nullptr, res_usec) - (TIME_GPS_EPOCH_UTC + TAI_GPS_DIFF);
+  if (timer)
+    *timer = t;
+  return t;
+}
+
+time_t pftime::utcToTai(time_t utc) {
+  return utc + pftime_leap::offset(utc);
+}
+
+time_t pftime::taiToUtc(time_t tai) {
+  return pftime_leap::tai_to_utc(tai);
+}
+
+int pftime::getTaiOffset(time_t utc) {
+  return pftime_leap::offset(utc);
+}
+
+int pftime::setLeapTable(const leap_entry_t *table, size_t count) {
+  return pftime_leap::settable(table, count);
+}
+
+int pftime::loadLeapSecondsList(const char *list, size_t len) {
+  return pftime_leap::loadlist(list, len);
+}
 
 int pftime::gettimeofday(struct timeval *tv, struct timezone *unused) {
   (void)unused;
 
   if (tv) {
-    ::gettimeofday(tv, nullptr);
+    readClock(tv);
     adjustLeapSec(&tv->tv_sec);
   }
   return 0;
 }
 
+void pftime::setFastClock(bool enable) {
+  pftime_fast::setenabled(enable);
+}
+
 int pftime::settimeofday(const struct timeval *tv, const struct timezone *unused, uint8_t li) {
   (void)unused;
   
   if (tv) {
     int result      = ::settimeofday(tv, nullptr);
     _leap_indicator = li;
+    pftime_fast::invalidate();
     if (li != LI_NO_WARNING) {
       _leap_time = calcNextLeapPoint(tv->tv_sec);
       //Serial.printf("Leap second will insert/delete after %d\n", _leap_time);
     }
+    pftime_stamp::onsync(tv, li, _leap_time);
+    // Remember the leap second even after _leap_indicator is cleared by the next syncing,
+    // once it's announced by more than one sync
+    if (li == LI_LAST_MINUTE_61_SEC || li == LI_LAST_MINUTE_59_SEC)
+      pftime_leap::observe(tv->tv_sec, _leap_time + 1, li == LI_LAST_MINUTE_61_SEC ? 1 : -1);
+    else if (li == LI_NO_WARNING)
+      pftime_leap::observe(tv->tv_sec, 0, 0);
     return result;
   }
   return 1;
 }
 
-#ifdef ESP32
-static void setTZ(const char *tz) {
-
+static void applyTZ(const char *tz) {
   char tzram[strlen_P(tz) + 1];
   memcpy_P(tzram, tz, sizeof(tzram));
-  setenv("TZ", tz, 1);
+#ifdef ESP8266
+  setTZ(tzram);
+#else
+  setenv("TZ", tzram, 1);
   tzset();
-}
 #endif
+  // Parse once here, so that pftime::localtime() needn't go through newlib's TZ machinery
+  pftime_tz::set(tzram);
+}
 
 // from esp32-hal-time.c
 static void setTimeZone(long offset, int daylight) {
@@ -196,7 +383,7 @@ static void setTimeZone(long offset, int daylight) {
     }
   }
   sprintf(tz, "%s%s", cst, cdt);
-  setTZ(tz);
+  applyTZ(tz);
 }
 
 /*
@@ -208,7 +395,7 @@ void pftime::configTime(long gmtOffset_sec, int daylightOffset_sec, const char *
     sntp_stop();
   pftime_sntp::stop();
 
-  //pftime_sntp::setoperatingmode(SNTP_OPMODE_POLL);
+  pftime_sntp::setoperatingmode(SNTP_OPMODE_POLL);
   pftime_sntp::setservername(0, server1);
   pftime_sntp::setservername(1, server2);
   pftime_sntp::setservername(2, server3);
@@ -229,15 +416,48 @@ void pftime::configTzTime(const char *tz, const char *server1, const char *serve
     sntp_stop();
   pftime_sntp::stop();
 
+  pftime_sntp::setoperatingmode(SNTP_OPMODE_POLL);
   pftime_sntp::setservername(0, server1);
   pftime_sntp::setservername(1, server2);
   pftime_sntp::setservername(2, server3);
 
-  setTZ(tz);
+  applyTZ(tz);
 
   pftime_sntp::init();
 }
 
+void pftime::configBroadcastTzTime(const char *tz, const char *server, const char *multicast_group) {
+  if (sntp_enabled())
+    sntp_stop();
+  pftime_sntp::stop();
+
+  pftime_sntp::setoperatingmode(SNTP_OPMODE_LISTENONLY);
+  pftime_sntp::setservername(0, server);
+  pftime_sntp::setservername(1, nullptr);
+  pftime_sntp::setservername(2, nullptr);
+#if LWIP_IGMP
+  ip_addr_t group;
+  if (multicast_group != nullptr && ipaddr_aton(multicast_group, &group))
+    pftime_sntp::setmulticastgroup(&group);
+  else
+    pftime_sntp::setmulticastgroup(nullptr);
+#else
+  (void)multicast_group;
+#endif
+
+  applyTZ(tz);
+
+  pftime_sntp::init();
+}
+
+bool pftime::startNtpServer(uint16_t port) {
+  return pftime_sntp::startserver(port) == ERR_OK;
+}
+
+void pftime::stopNtpServer() {
+  pftime_sntp::stopserver();
+}
+
 void pftime::setSyncSuccessCallback(sync_callback_t cb) {
   pftime_sntp::setsynccallback(cb);
 }
@@ -245,3 +465,217 @@ void pftime::setSyncSuccessCallback(sync_callback_t cb) {
 void pftime::setSyncFailCallback(fail_callback_t cb) {
   pftime_sntp::setfailcallback(cb);
 }
+
+bool pftime::addSyncListener(event_callback_t cb, void *ctx) {
+  return pftime_sntp::addlistener(cb, ctx) == ERR_OK;
+}
+
+void pftime::removeSyncListener(event_callback_t cb, void *ctx) {
+  pftime_sntp::removelistener(cb, ctx);
+}
+
+void pftime::setDeferredCallback(bool deferred) {
+  pftime_sntp::setdeferred(deferred);
+}
+
+size_t pftime::dispatchCallbacks() {
+  return pftime_sntp::dispatch();
+}
+
+uint32_t pftime::getDroppedEvents() {
+  return pftime_sntp::getdroppedevents();
+}
+
+void pftime::setSyncJitter(uint32_t startup_ms, uint8_t poll_percent) {
+  pftime_sntp::setjitter(startup_ms, poll_percent);
+}
+
+void pftime::setInterleavedMode(bool interleaved) {
+  pftime_sntp::setinterleaved(interleaved);
+}
+
+void pftime::setDualStack(bool dual_stack) {
+  pftime_sntp::setdualstack(dual_stack);
+}
+
+bool pftime::syncNow() {
+  return pftime_sntp::syncnow();
+}
+
+bool pftime::waitForSync(uint32_t timeout_ms) {
+  return pftime_sntp::waitsync(timeout_ms);
+}
+
+uint8_t pftime::getClockState() {
+  return pftime_hold::check();
+}
+
+uint32_t pftime::getClockError() {
+  return pftime_hold::error();
+}
+
+int32_t pftime::getFrequencyOffset() {
+  return pftime_hold::frequency();
+}
+
+void pftime::setClockStateCallback(clock_state_callback_t cb) {
+  pftime_hold::setcallback(cb);
+}
+
+void pftime::setSampleRecorder(sync_sample_t *ring, size_t count) {
+  pftime_rec::setring(ring, count);
+}
+
+void pftime::setSampleSink(sample_sink_t sink, void *ctx) {
+  pftime_rec::setsink(sink, ctx);
+}
+
+size_t pftime::takeSamples(sync_sample_t *results, size_t count) {
+  if (results == nullptr)
+    return 0;
+  return pftime_rec::take(results, count);
+}
+
+uint32_t pftime::getDroppedSamples() {
+  return pftime_rec::getdropped();
+}
+
+size_t pftime::getTrace(trace_entry_t *results, size_t count) {
+  if (results == nullptr)
+    return 0;
+  return pftime_sntp::gettrace(results, count);
+}
+
+const char *pftime::getTraceEventName(uint8_t event) {
+  switch (event) {
+  case TRACE_START:       return "START";
+  case TRACE_STOP:        return "STOP";
+  case TRACE_REQUEST:     return "REQUEST";
+  case TRACE_HOLD:        return "HOLD";
+  case TRACE_RESOLVE:     return "RESOLVE";
+  case TRACE_RESOLVED:    return "RESOLVED";
+  case TRACE_SEND:        return "SEND";
+  case TRACE_RECV:        return "RECV";
+  case TRACE_SCHEDULE:    return "SCHEDULE";
+  case TRACE_RETRY:       return "RETRY";
+  case TRACE_NEXT_SERVER: return "NEXT_SERVER";
+  default:                return "?";
+  }
+}
+
+pftime::SntpClient::SntpClient() : _client(nullptr) {
+}
+
+pftime::SntpClient::~SntpClient() {
+  end();
+}
+
+bool pftime::SntpClient::begin(const char *server1, const char *server2, const char *server3) {
+  end();
+
+  _client = pftime_sntp::newclient();
+  if (_client == nullptr)
+    return false;
+
+  pftime_sntp::setservername(_client, 0, server1);
+  pftime_sntp::setservername(_client, 1, server2);
+  pftime_sntp::setservername(_client, 2, server3);
+  pftime_sntp::init(_client);
+  return true;
+}
+
+void pftime::SntpClient::end() {
+  if (_client == nullptr)
+    return;
+
+  pftime_sntp::deleteclient(_client);
+  _client = nullptr;
+}
+
+void pftime::SntpClient::setUpdateDelay(uint32_t ms) {
+  if (_client != nullptr)
+    pftime_sntp::set_update_delay(_client, ms);
+}
+
+void pftime::SntpClient::setInterleaved(bool interleaved) {
+  if (_client != nullptr)
+    pftime_sntp::setinterleaved(_client, interleaved);
+}
+
+void pftime::SntpClient::setDualStack(bool dual_stack) {
+  if (_client != nullptr)
+    pftime_sntp::setdualstack(_client, dual_stack);
+}
+
+bool pftime::SntpClient::isSynced() const {
+  return _client != nullptr && pftime_sntp::getstatus(_client)->synced;
+}
+
+int64_t pftime::SntpClient::getOffset() const {
+  return _client != nullptr ? pftime_sntp::getstatus(_client)->offset_us : 0;
+}
+
+int64_t pftime::SntpClient::getRoundTripDelay() const {
+  return _client != nullptr ? pftime_sntp::getstatus(_client)->rtt_us : 0;
+}
+
+uint8_t pftime::SntpClient::getStratum() const {
+  return _client != nullptr ? pftime_sntp::getstatus(_client)->stratum : 0;
+}
+
+uint32_t pftime::SntpClient::getRequestCount() const {
+  return _client != nullptr ? pftime_sntp::getstats(_client)->requests : 0;
+}
+
+uint32_t pftime::SntpClient::getResponseCount() const {
+  return _client != nullptr ? pftime_sntp::getstats(_client)->accepted : 0;
+}
+
+int pftime::scheduleAt(const struct timeval *when, timer_callback_t cb, void *ctx) {
+  return pftime_sched::at(when, cb, ctx);
+}
+
+int pftime::scheduleEvery(uint32_t period_ms, uint32_t phase_ms, timer_callback_t cb, void *ctx, bool local) {
+  return pftime_sched::every(period_ms, phase_ms, cb, ctx, local);
+}
+
+void pftime::cancelSchedule(int id) {
+  pftime_sched::cancel(id);
+}
+
+uint32_t pftime::runSchedule() {
+  return pftime_sched::run();
+}
+
+bool IRAM_ATTR pftime::captureTimestamp(uint32_t tag) {
+  return pftime_stamp::capture(tag);
+}
+
+size_t pftime::drainTimestamps(timestamp_t *results, size_t count) {
+  if (results == nullptr)
+    return 0;
+
+  // Leap seconds are applied by the state at each capture, not the current one
+  return pftime_stamp::drain(results, count);
+}
+
+uint32_t pftime::getDroppedTimestamps() {
+  return pftime_stamp::getdropped();
+}
+
+pftime::hlc_t pftime::hlcNow() {
+  struct timeval tv;
+  readClock(&tv);
+  return pftime_hlc::now(&tv);
+}
+
+pftime::hlc_t pftime::hlcUpdate(hlc_t remote) {
+  struct timeval tv;
+  readClock(&tv);
+  return pftime_hlc::update(&tv, remote);
+}
+
+void pftime::hlcToTimeval(hlc_t hlc, struct timeval *tv) {
+  if (tv != nullptr)
+    pftime_hlc::totimeval(hlc, tv);
+}
@@ -17,6 +17,67 @@
 //! @brief The NTP server's clock not synchronized
 #define LI_ALARM_CONDITION    0x03
 
+//! @brief sync_event_t::type: Time syncing completed successfully
+#define SYNC_EVENT_SUCCESS    0
+//! @brief sync_event_t::type: Time syncing failed
+#define SYNC_EVENT_FAIL       1
+
+//! @brief getClockState(): Never synced, and SNTP client not started
+#define CLOCK_STATE_UNSYNCHRONIZED 0
+//! @brief getClockState(): SNTP client started, waiting for the first sync
+#define CLOCK_STATE_ACQUIRING      1
+//! @brief getClockState(): Synced, and the next sync is not overdue
+#define CLOCK_STATE_LOCKED         2
+//! @brief getClockState(): Free-running on the last frequency estimate, since the servers are unreachable
+#define CLOCK_STATE_HOLDOVER       3
+//! @brief getClockState(): Free-running too long: the estimated error exceeds the limit
+#define CLOCK_STATE_EXPIRED        4
+
+//! @brief sync_sample_t::flags: The sample only measured the offset (by a SntpClient), without setting the clock
+#define SAMPLE_MEASURE_ONLY   0x01
+//! @brief sync_sample_t::flags: The sample is of the previous exchange, with the precise transmit timestamp from an interleaved response
+#define SAMPLE_INTERLEAVED    0x02
+
+//! @brief trace_entry_t::event: The client started (arg: delay of the first request in milliseconds)
+#define TRACE_START           1
+//! @brief trace_entry_t::event: The client stopped
+#define TRACE_STOP            2
+//! @brief trace_entry_t::event: A request is due (arg: index of the server)
+#define TRACE_REQUEST         3
+//! @brief trace_entry_t::event: The server is on hold after Kiss-of-Death "RATE" (arg: remaining hold in seconds)
+#define TRACE_HOLD            4
+//! @brief trace_entry_t::event: Resolving the server name started (arg: index of the server)
+#define TRACE_RESOLVE         5
+//! @brief trace_entry_t::event: The server name was resolved (arg: 0 for IPv4, 1 for IPv6, or @c TRACE_ARG_NONE on failure)
+#define TRACE_RESOLVED        6
+//! @brief trace_entry_t::event: A request was sent (arg: 0 for IPv4, 1 for IPv6, or @c TRACE_ARG_NONE when out of memory)
+#define TRACE_SEND            7
+//! @brief trace_entry_t::event: A packet was received (arg: 0 accepted, 1 Kiss-of-Death, 2 rejected, 3 ignored since no request was in flight over its address family)
+#define TRACE_RECV            8
+//! @brief trace_entry_t::event: The next request was scheduled after a sync (arg: delay in seconds)
+#define TRACE_SCHEDULE        9
+//! @brief trace_entry_t::event: The request will be retried (arg: delay in milliseconds)
+#define TRACE_RETRY           10
+//! @brief trace_entry_t::event: Switched to another server after a timeout or an error (arg: index of the server)
+#define TRACE_NEXT_SERVER     11
+//! @brief trace_entry_t::arg: No value, or a failure
+#define TRACE_ARG_NONE        0xFFFF
+
+//! @brief format_rfc3339(): Express in UTC, with "Z" suffix
+#define RFC3339_UTC           0x00
+//! @brief format_rfc3339(): Express in local time, with numeric offset
+#define RFC3339_LOCAL         0x01
+//! @brief format_rfc3339(): Append milliseconds
+#define RFC3339_MILLIS        0x02
+//! @brief format_rfc3339(): Append microseconds
+#define RFC3339_MICROS        0x04
+//! @brief Buffer size enough for any output of format_rfc3339()
+#define RFC3339_BUF_SIZE      33
+
+namespace pftime_sntp {
+struct sntp_client;
+} // namespace pftime_sntp
+
 namespace pftime {
 
 /**
@@ -50,6 +111,87 @@ struct tm *gmtime(const time_t *timer, suseconds_t *res_usec = nullptr);
  */
 struct tm *localtime(const time_t *timer, suseconds_t *res_usec = nullptr);
 
+/**
+ * @brief Packed calendar time, for storing a lot of timestamps.
+ */
+struct datetime_t {
+  uint16_t year;   //!< Year (e.g. 2020)
+  uint8_t  month;  //!< Month (1-12)
+  uint8_t  day;    //!< Day of the month (1-31)
+  uint8_t  hour;   //!< Hours (0-23)
+  uint8_t  minute; //!< Minutes (0-59)
+  uint8_t  second; //!< Seconds (0-60)
+  uint8_t  isdst;  //!< 1 if DST is in effect, otherwise 0
+  uint32_t usec;   //!< Microseconds (0-999999)
+};
+
+/**
+ * @brief Converts an array of system clock values (as read by built-in @c gettimeofday()) into calendar time, expressed in UTC. @n
+ *        Leap seconds are handled in the same way as gmtime(nullptr), and date calculation is reused among entries on the same day,
+ *        so it's fastest when @c timers are sorted or nearly sorted.
+ * 
+ * @param[in]  timers   Array of @c time_t objects for convert
+ * @param[out] results  Array of @c count objects for result
+ * @param[in]  count    Number of entries
+ * @return              Number of converted entries
+ */
+size_t gmtime_batch(const time_t *timers, struct tm *results, size_t count);
+//! @copydoc gmtime_batch(const time_t *, struct tm *, size_t)
+size_t gmtime_batch(const time_t *timers, datetime_t *results, size_t count);
+//! @copydoc gmtime_batch(const time_t *, struct tm *, size_t)
+size_t gmtime_batch(const struct timeval *timers, struct tm *results, size_t count);
+//! @copydoc gmtime_batch(const time_t *, struct tm *, size_t)
+size_t gmtime_batch(const struct timeval *timers, datetime_t *results, size_t count);
+
+/**
+ * @brief Same as gmtime_batch(), but expressed in local time.
+ * 
+ * @param[in]  timers   Array of @c time_t objects for convert
+ * @param[out] results  Array of @c count objects for result
+ * @param[in]  count    Number of entries
+ * @return              Number of converted entries
+ */
+size_t localtime_batch(const time_t *timers, struct tm *results, size_t count);
+//! @copydoc localtime_batch(const time_t *, struct tm *, size_t)
+size_t localtime_batch(const time_t *timers, datetime_t *results, size_t count);
+//! @copydoc localtime_batch(const time_t *, struct tm *, size_t)
+size_t localtime_batch(const struct timeval *timers, struct tm *results, size_t count);
+//! @copydoc localtime_batch(const time_t *, struct tm *, size_t)
+size_t localtime_batch(const struct timeval *timers, datetime_t *results, size_t count);
+
+/**
+ * @brief Writes a timestamp in RFC 3339 format (e.g. <tt>2020-07-01T08:59:60.123+09:00</tt>) into @c buf, without using @c printf() nor @c strftime(). @n
+ *        If @c tv is null pointer, the function uses the current time, and prints an inserted leap second as <tt>:60</tt>.
+ * 
+ * @param[out] buf    Buffer for result (@c RFC3339_BUF_SIZE bytes are always enough)
+ * @param[in]  len    Size of @c buf
+ * @param[in]  tv     Pointer to a timeval object for format (can be null pointer)
+ * @param[in]  flags  Combination of @c RFC3339_UTC or @c RFC3339_LOCAL, and @c RFC3339_MILLIS or @c RFC3339_MICROS
+ * @retval     0      When failure (e.g. @c buf is too small)
+ * @return            The number of characters written, not including the terminating null character
+ */
+size_t format_rfc3339(char *buf, size_t len, const struct timeval *tv = nullptr, int flags = RFC3339_UTC);
+
+/**
+ * @brief Parses a timestamp in RFC 3339 format (e.g. <tt>2016-12-31T23:59:60.5Z</tt>, <tt>2020-07-01T09:00:00+09:00</tt>). @n
+ *        Fractional seconds are truncated to microseconds. An inserted leap second is stored as 23:59:59, and reported by @c leap_sec.
+ * 
+ * @param[in]  str       The string for parse
+ * @param[out] tv        Pointer to a timeval object for result
+ * @param[out] leap_sec  Pointer to a @c bool object set to whether @c str is a leap second (can be null pointer)
+ * @retval     0         When failure
+ * @return               The number of characters parsed
+ */
+size_t parse_rfc3339(const char *str, struct timeval *tv, bool *leap_sec = nullptr);
+
+/**
+ * @brief Converts calendar time expressed in UTC into UNIX time, the inverse of gmtime(). Fields of @c tm out of range are normalized.
+ * 
+ * @param[in,out] tm  Pointer to a <tt>struct tm</tt> object for convert
+ * @return            The number of seconds since the UNIX Epoch
+ */
+time_t mkgmtime(struct tm *tm);
+
 /**
  * @brief Gets the current calendar time, the number of seconds and microseconds since the UNIX Epoch.
  * 
@@ -60,6 +202,19 @@ struct tm *localtime(const time_t *timer, suseconds_t *res_usec = nullptr);
  */
 int gettimeofday(struct timeval *tv, struct timezone *unused);
 
+/**
+ * @brief Makes gettimeofday() read the hardware counter (CCOUNT on ESP8266, esp_timer on ESP32) from an anchor
+ *        instead of the system call. A read then costs a few multiplications and additions, without the 64-bit divisions
+ *        of the system call (which are library calls on ESP8266), plus reading the 64-bit monotonic counter. @n
+ *        The anchor is taken from the system clock on the first read, after each syncing and whenever it gets older than
+ *        @c PFTIME_FAST_MAX_AGE_MS on the monotonic counter (on ESP8266 also when half of the CCOUNT range has elapsed),
+ *        so an idle gap of any length is caught, and the rate of the system clock measured between anchors is applied
+ *        (e.g. while adjtime() slews it). Don't enable this if the CPU frequency is changed at runtime on ESP8266.
+ * 
+ * @param enable  true to enable, false to disable (default)
+ */
+void setFastClock(bool enable);
+
 /**
  * @brief Sets the current calendar time, the number of seconds and microseconds since the UNIX Epoch.
  * 
@@ -107,11 +262,100 @@ void configTime(const char *tz, const char *server1, const char *server2 = nullp
  */
 void configTzTime(const char *tz, const char *server1, const char *server2 = nullptr, const char *server3 = nullptr);
 
+/**
+ * @brief Initializes SNTP client in broadcast mode with given timezone, and starts it. @n
+ *        The one-way delay from the server is calibrated by a unicast exchange with @c server at first,
+ *        then the time is synchronized only from broadcast (or multicast) packets, without sending any request. @n
+ *        If port 123 can't be bound, the fail callback is invoked and the client stays stopped.
+ * 
+ * @param tz               A timezone definition, expressed in POSIX-style tz format
+ * @param server           The NTP server address to calibrate the delay (can be null pointer, then the delay is regarded as 0)
+ * @param multicast_group  Multicast address to join, e.g. "224.0.1.1" (optional; null pointer to receive broadcast only)
+ */
+void configBroadcastTzTime(const char *tz, const char *server, const char *multicast_group = nullptr);
+
+/**
+ * @brief Starts NTP server mode, which answers requests from other hosts (e.g. in LAN) with the time synchronized by this library. @n
+ *        Stratum, reference ID, root delay and root dispersion are derived from the last synchronization. @n
+ *        It can run along with broadcast mode (configBroadcastTzTime()) on port 123: the server then owns the port and passes broadcasts to the client.
+ * 
+ * @param port  UDP port to listen
+ * @retval true   When success
+ * @retval false  When failure
+ */
+bool startNtpServer(uint16_t port = 123);
+
+/**
+ * @brief Stops NTP server mode.
+ */
+void stopNtpServer();
+
 /**
  * @brief Get current Leap Indicator value
  */
 uint8_t getLeapIndicator();
 
+/**
+ * @brief An entry of the leap second table.
+ */
+struct leap_entry_t {
+  time_t  utc;        //!< UNIX time when @c tai_offset takes effect
+  int16_t tai_offset; //!< TAI - UTC (in seconds)
+};
+
+/**
+ * @brief Returns the current time in TAI, the number of seconds since 1970-01-01 00:00:00 TAI.
+ * 
+ * @param[out] timer     Pointer to a @c time_t object where the time will be stored (can be null pointer)
+ * @param[out] res_usec  Pointer to a @c suseconds_t object for microseconds part (can be null pointer)
+ * @return               The number of seconds since the TAI Epoch
+ */
+time_t tai_time(time_t *timer, suseconds_t *res_usec = nullptr);
+
+/**
+ * @brief Returns the current time in GPS time, the number of seconds since 1980-01-06 00:00:00 UTC.
+ * 
+ * @param[out] timer     Pointer to a @c time_t object where the time will be stored (can be null pointer)
+ * @param[out] res_usec  Pointer to a @c suseconds_t object for microseconds part (can be null pointer)
+ * @return               The number of seconds since the GPS Epoch
+ */
+time_t gps_time(time_t *timer, suseconds_t *res_usec = nullptr);
+
+/**
+ * @brief Converts UNIX time into TAI, using the leap second table.
+ */
+time_t utcToTai(time_t utc);
+
+/**
+ * @brief Converts TAI into UNIX time, using the leap second table. An inserted leap second is expressed as 23:59:59 repeated.
+ */
+time_t taiToUtc(time_t tai);
+
+/**
+ * @brief Returns TAI - UTC (in seconds) at given UNIX time.
+ */
+int getTaiOffset(time_t utc);
+
+/**
+ * @brief Replaces the built-in leap second table.
+ * 
+ * @param table  Entries sorted by @c utc
+ * @param count  Number of entries
+ * @retval   -1  When failure (the table is not changed)
+ * @return       Number of entries loaded
+ */
+int setLeapTable(const leap_entry_t *table, size_t count);
+
+/**
+ * @brief Replaces the built-in leap second table with the content of @c leap-seconds.list published by IERS/NIST.
+ * 
+ * @param list  The file content (need not be null-terminated)
+ * @param len   Length of @c list
+ * @retval  -1  When failure (the table is not changed)
+ * @return      Number of entries loaded
+ */
+int loadLeapSecondsList(const char *list, size_t len);
+
 /**
  * @brief The callback function type for setSyncSuccessCallback().
  */
@@ -136,6 +380,424 @@ using fail_callback_t = void (*)(const char *);
  */
 void setSyncFailCallback(fail_callback_t cb);
 
+/**
+ * @brief Describes a time syncing event.
+ */
+struct sync_event_t {
+  uint8_t     type;           //!< @c SYNC_EVENT_SUCCESS or @c SYNC_EVENT_FAIL
+  uint8_t     leap_indicator; //!< Leap Indicator sent by the server
+  uint8_t     stratum;        //!< Stratum of the server
+  uint8_t     server_index;   //!< Index of the server (0 to 2)
+  const char *server;         //!< Name of the server, as passed to configTzTime() (can be null pointer)
+  int64_t     offset_us;      //!< Offset applied to the clock (in microseconds)
+  int64_t     rtt_us;         //!< Round-trip delay (in microseconds; 0 in broadcast mode)
+  const char *message;        //!< Reason of the failure (@c SYNC_EVENT_FAIL only)
+};
+
+/**
+ * @brief The callback function type for addSyncListener().
+ */
+using event_callback_t = void (*)(const sync_event_t *event, void *ctx);
+
+/**
+ * @brief Adds a listener called on every time syncing event, along with the callbacks set by setSyncSuccessCallback() and setSyncFailCallback(). @n
+ *        Up to @c SNTP_MAX_LISTENERS (4 by default) listeners can be added (no heap allocation).
+ * 
+ * @param cb   The callback function as a @c event_callback_t object
+ * @param ctx  Any pointer passed to @c cb
+ * @retval true   When success
+ * @retval false  When failure (no room for the listener)
+ */
+bool addSyncListener(event_callback_t cb, void *ctx = nullptr);
+
+/**
+ * @brief Removes a listener added by addSyncListener().
+ * 
+ * @param cb   The callback function
+ * @param ctx  The pointer passed to addSyncListener()
+ */
+void removeSyncListener(event_callback_t cb, void *ctx = nullptr);
+
+/**
+ * @brief Defers the callbacks and listeners until dispatchCallbacks() is called. @n
+ *        By default, the callbacks are invoked in the network (lwIP) thread, so slow callbacks stall the whole network stack.
+ *        When deferred, events are pushed into a small fixed-size queue (events are dropped when it's full).
+ * 
+ * @param deferred  true to defer, false to invoke them immediately (default)
+ */
+void setDeferredCallback(bool deferred);
+
+/**
+ * @brief Invokes the deferred callbacks. Call this from @c loop() or your own task (only one task).
+ * 
+ * @return The number of invoked callbacks
+ */
+size_t dispatchCallbacks();
+
+/**
+ * @brief Gets the number of events dropped because the queue of deferred callbacks was full (@c SNTP_EVENT_QUEUE_SIZE).
+ */
+uint32_t getDroppedEvents();
+
+/**
+ * @brief Randomizes the timing of the requests, so that many devices (e.g. powered on together after an outage) don't hit the NTP servers at once. @n
+ *        Call this before configTzTime() for the first request to be delayed.
+ * 
+ * @param startup_ms    Max random delay of the first request (in milliseconds; 0 by default)
+ * @param poll_percent  Randomization of the interval of the following requests (in percent; 10 by default)
+ */
+void setSyncJitter(uint32_t startup_ms, uint8_t poll_percent = 10);
+
+/**
+ * @brief Sends requests in NTPv4 interleaved mode, to get the transmit timestamp the server captured after its response left (e.g. chrony with hardware timestamping). @n
+ *        After each basic exchange, a follow-up request is sent 2 seconds later to get the precise timestamp of that exchange,
+ *        unless the server asked for a longer interval with a RATE Kiss-of-Death.
+ *        Once a server has answered a follow-up, each poll syncs the clock once, to the follow-up; until then, both exchanges sync it.
+ *        Servers which keep answering in basic mode are polled in basic mode.
+ * 
+ * @param interleaved  true to enable (false by default)
+ */
+void setInterleavedMode(bool interleaved);
+
+/**
+ * @brief Resolves NTP servers given by name to both IPv4 and IPv6 addresses, and races requests over them (RFC 8305 style).
+ *        Turn this off to use only the address the DNS resolver returns. @n
+ *        Has no effect if the library is built with @c SNTP_SUPPORT_DUAL_STACK 0 (the default without IPv6).
+ * 
+ * @param dual_stack  true to enable (default), false to disable
+ */
+void setDualStack(bool dual_stack);
+
+/**
+ * @brief Requests a sync as soon as possible, without blocking (e.g. after Wi-Fi reconnects). @n
+ *        Requests while a sync is in progress are coalesced into it, and a request is never sent
+ *        within 15 seconds (@c SNTP_SYNC_NOW_MIN_INTERVAL) of the previous one, to protect the servers,
+ *        nor within the interval a server asked for with a RATE Kiss-of-Death.
+ * 
+ * @retval true   When a sync is in progress or scheduled
+ * @retval false  When the time syncing is not started (call configTime() or configTzTime() first),
+ *                or in broadcast mode (configBroadcastTzTime()), which syncs only when a broadcast comes
+ */
+bool syncNow();
+
+/**
+ * @brief Blocks the calling task until the next successful sync (e.g. requested by syncNow()), or the timeout. @n
+ *        The task sleeps on a semaphore while waiting. Don't call this from the callbacks or listeners.
+ * 
+ * @param timeout_ms  The max time to wait (in milliseconds)
+ * @retval true   When synced
+ * @retval false  When timed out, or the time syncing is not started
+ */
+bool waitForSync(uint32_t timeout_ms);
+
+/**
+ * @brief Returns the quality of the clock: @c CLOCK_STATE_UNSYNCHRONIZED, @c CLOCK_STATE_ACQUIRING, @c CLOCK_STATE_LOCKED, @c CLOCK_STATE_HOLDOVER or @c CLOCK_STATE_EXPIRED. @n
+ *        The clock enters holdover when a sync is overdue, and keeps being corrected by the frequency estimated from the past syncs.
+ *        It expires when the estimated error grows beyond @c PFTIME_HOLD_MAX_ERROR_US.
+ */
+uint8_t getClockState();
+
+/**
+ * @brief Returns the estimated error of the clock (in microseconds), which grows since the last sync.
+ * 
+ * @retval UINT32_MAX  When never synced
+ */
+uint32_t getClockError();
+
+/**
+ * @brief Returns the frequency error of the system clock estimated from the past syncs (in PPB; positive if it runs slow). @n
+ *        The time returned by this library is corrected with it between syncs.
+ * 
+ * @retval 0  When not estimated yet (until two syncs)
+ */
+int32_t getFrequencyOffset();
+
+/**
+ * @brief The callback function type for setClockStateCallback().
+ */
+using clock_state_callback_t = void (*)(uint8_t state);
+
+/**
+ * @brief Set the callback called when the quality of the clock changes (see getClockState()). @n
+ *        It's invoked in the network (lwIP) thread on syncs and requests, or in the task calling getClockState().
+ * 
+ * @param cb The callback function as a @c clock_state_callback_t object
+ */
+void setClockStateCallback(clock_state_callback_t cb);
+
+/**
+ * @brief A raw sample of time syncing, recorded for offline analysis (e.g. replaying with @c tools/replay). @n
+ *        48 bytes, without padding. Timestamps are UNIX time in microseconds.
+ */
+struct sync_sample_t {
+  int64_t  t1_us;   //!< Local clock when the request was sent (0 in broadcast mode)
+  int64_t  t2_us;   //!< Server clock when the request was received (0 in broadcast mode)
+  int64_t  t3_us;   //!< Server clock when the response was sent
+  int64_t  t4_us;   //!< Local clock when the response was received
+  int64_t  mono_us; //!< Monotonic counter (uptime in microseconds) at @c t4_us (at the interleaved response for @c SAMPLE_INTERLEAVED)
+  uint32_t server;  //!< IPv4 address of the server (network byte order; XOR of the words for IPv6)
+  uint8_t  li;      //!< Leap Indicator sent by the server
+  uint8_t  stratum; //!< Stratum of the server
+  uint8_t  mode;    //!< 4 (server) or 5 (broadcast)
+  uint8_t  flags;   //!< @c SAMPLE_MEASURE_ONLY and/or @c SAMPLE_INTERLEAVED, or 0
+};
+
+/**
+ * @brief The callback function type for setSampleSink().
+ */
+using sample_sink_t = void (*)(const sync_sample_t *sample, void *ctx);
+
+/**
+ * @brief Starts recording samples of time syncing into @c ring, to be taken out by takeSamples(). @n
+ *        When the ring is full, new samples are dropped until taken.
+ * 
+ * @param ring   An array to store the samples (null pointer to stop recording)
+ * @param count  The number of elements of @c ring (at least 2; one element is kept empty)
+ */
+void setSampleRecorder(sync_sample_t *ring, size_t count);
+
+/**
+ * @brief Passes every sample of time syncing to @c sink, e.g. to append it to a file. @n
+ *        It's invoked in the network (lwIP) thread, so it must return quickly; record into a ring by setSampleRecorder() for slow sinks.
+ * 
+ * @param sink  The callback function as a @c sample_sink_t object (null pointer to stop)
+ * @param ctx   Any pointer passed to @c sink
+ */
+void setSampleSink(sample_sink_t sink, void *ctx = nullptr);
+
+/**
+ * @brief Takes samples recorded by setSampleRecorder() out of the ring. Call this from @c loop() or your own task (only one task).
+ * 
+ * @param results  An array to store the samples
+ * @param count    The number of elements of @c results
+ * @return The number of stored samples
+ */
+size_t takeSamples(sync_sample_t *results, size_t count);
+
+/**
+ * @brief Gets the number of samples dropped because the ring was full.
+ */
+uint32_t getDroppedSamples();
+
+/**
+ * @brief An entry of the trace of the SNTP state machine, to diagnose e.g. slow first syncs. 8 bytes.
+ */
+struct trace_entry_t {
+  uint32_t time_us; //!< Lower 32 bits of the monotonic counter (uptime in microseconds; wraps every 71 minutes)
+  uint8_t  event;   //!< @c TRACE_START, @c TRACE_REQUEST, etc.
+  uint8_t  client;  //!< 0 for the client started by configTzTime(), 1 or more for a SntpClient
+  uint16_t arg;     //!< Depends on @c event (saturated at 0xFFFE if too large)
+};
+
+/**
+ * @brief Copies the latest entries of the trace of the SNTP state machine, oldest first. @n
+ *        The trace is a ring of the last 32 state transitions (@c SNTP_TRACE_SIZE; 0 to drop it from the build),
+ *        recorded all the time and left intact by this function. Safe to call from any task.
+ * 
+ * @param results  An array to store the entries
+ * @param count    The number of elements of @c results
+ * @return The number of stored entries
+ */
+size_t getTrace(trace_entry_t *results, size_t count);
+
+/**
+ * @brief Returns the name of a trace event, e.g. "REQUEST" for @c TRACE_REQUEST, to dump the trace.
+ * 
+ * @param event  @c trace_entry_t::event
+ */
+const char *getTraceEventName(uint8_t event);
+
+/**
+ * @brief An additional SNTP client, which measures the offset of its servers from the system clock without setting it. @n
+ *        Several clients can run concurrently along with the one started by configTzTime() (e.g. to compare a LAN master clock with public UTC),
+ *        each on its own UDP socket with its own statistics. Up to @c SNTP_MAX_CLIENTS (2 by default) clients can be begun at once (no heap allocation).
+ */
+class SntpClient {
+public:
+  SntpClient();
+  ~SntpClient();
+  SntpClient(const SntpClient &)            = delete;
+  SntpClient &operator=(const SntpClient &) = delete;
+
+  /**
+   * @brief Starts the client.
+   * 
+   * @param server1 The primary NTP server address
+   * @param server2 The secondary NTP server address (optional)
+   * @param server3 The tertiary NTP server address (optional)
+   * @retval true   When success
+   * @retval false  When failure (no room for the client)
+   */
+  bool begin(const char *server1, const char *server2 = nullptr, const char *server3 = nullptr);
+
+  /**
+   * @brief Stops the client.
+   */
+  void end();
+
+  /**
+   * @brief Sets the interval of requests after a successful exchange (at least 15 seconds).
+   * 
+   * @param ms  The interval (in milliseconds)
+   */
+  void setUpdateDelay(uint32_t ms);
+
+  /**
+   * @brief Sends requests in NTPv4 interleaved mode (see pftime::setInterleavedMode()).
+   * 
+   * @param interleaved  true to enable (false by default)
+   */
+  void setInterleaved(bool interleaved);
+
+  /**
+   * @brief Races requests over IPv4 and IPv6 to servers given by name (see pftime::setDualStack()).
+   * 
+   * @param dual_stack  true to enable (default), false to disable
+   */
+  void setDualStack(bool dual_stack);
+
+  /**
+   * @brief Returns whether any exchange has completed successfully.
+   */
+  bool isSynced() const;
+
+  /**
+   * @brief Returns the offset of the server from the system clock, measured by the last exchange (in microseconds).
+   */
+  int64_t getOffset() const;
+
+  /**
+   * @brief Returns the round-trip delay of the last exchange (in microseconds).
+   */
+  int64_t getRoundTripDelay() const;
+
+  /**
+   * @brief Returns the stratum of the server of the last exchange.
+   */
+  uint8_t getStratum() const;
+
+  /**
+   * @brief Returns the number of requests sent since begin().
+   */
+  uint32_t getRequestCount() const;
+
+  /**
+   * @brief Returns the number of valid responses received since begin().
+   */
+  uint32_t getResponseCount() const;
+
+private:
+  pftime_sntp::sntp_client *_client;
+};
+
+/**
+ * @brief Type of the callback function of the timers added by scheduleAt() and scheduleEvery().
+ */
+using timer_callback_t = void (*)(void *ctx);
+
+/**
+ * @brief Schedules a one-shot timer at given time (on the synced clock, not on the uptime). @n
+ *        The callback is invoked from runSchedule().
+ * 
+ * @param when  The UNIX time to fire
+ * @param cb    The callback function as a @c timer_callback_t object
+ * @param ctx   Any pointer passed to @c cb
+ * @return The timer id, or -1 when failure (no room for the timer)
+ */
+int scheduleAt(const struct timeval *when, timer_callback_t cb, void *ctx = nullptr);
+
+/**
+ * @brief Schedules a periodic timer aligned to the wall clock (e.g. "every 15 minutes on the quarter hour"). @n
+ *        The callback is invoked from runSchedule(). Missed periods are skipped, and the timer is re-aligned when the clock is stepped by syncing.
+ * 
+ * @param period_ms  The period (in milliseconds)
+ * @param phase_ms   The offset from the aligned instant (in milliseconds)
+ * @param cb         The callback function as a @c timer_callback_t object
+ * @param ctx        Any pointer passed to @c cb
+ * @param local      true to align to the local time instead of UTC
+ * @return The timer id, or -1 when failure (no room for the timer)
+ */
+int scheduleEvery(uint32_t period_ms, uint32_t phase_ms, timer_callback_t cb, void *ctx = nullptr, bool local = false);
+
+/**
+ * @brief Cancels a timer added by scheduleAt() or scheduleEvery().
+ * 
+ * @param id  The timer id
+ */
+void cancelSchedule(int id);
+
+/**
+ * @brief Invokes the callbacks of the expired timers. Call this from @c loop() or your own task (only one task).
+ * 
+ * @return Microseconds until the next deadline (@c UINT32_MAX if no timer is scheduled), which can be used for sleeping
+ */
+uint32_t runSchedule();
+
+/**
+ * @brief Describes a timestamp recorded by captureTimestamp().
+ */
+struct timestamp_t {
+  struct timeval tv;  //!< UNIX time of the capture
+  uint32_t       tag; //!< The tag passed to captureTimestamp()
+};
+
+/**
+ * @brief Records the current time into a lock-free ring buffer. Safe to call from ISRs (placed in IRAM). @n
+ *        Only the raw microsecond counter is read here; it is converted into UTC by drainTimestamps().
+ * 
+ * @param tag  Any value to identify the event (e.g. pin number)
+ * @retval true   When success
+ * @retval false  When the ring buffer is full (the timestamp is dropped)
+ */
+bool captureTimestamp(uint32_t tag = 0);
+
+/**
+ * @brief Takes timestamps recorded by captureTimestamp() out of the ring buffer, converted into UTC. @n
+ *        The conversion uses the offset and drift between syncs, so timestamps captured just before a sync are corrected by that sync
+ *        (drain them some time after the sync for the best accuracy). Call this from @c loop() or your own task (only one task).
+ * 
+ * @param results  An array to store the timestamps
+ * @param count    The number of elements of @c results
+ * @return The number of stored timestamps
+ */
+size_t drainTimestamps(timestamp_t *results, size_t count);
+
+/**
+ * @brief Gets the number of timestamps dropped because the ring buffer was full.
+ */
+uint32_t getDroppedTimestamps();
+
+/**
+ * @brief A hybrid logical clock (HLC) timestamp: the upper 48 bits are UNIX time in 1/65536 seconds (from the synced clock),
+ *        the lower 16 bits a logical counter. @n
+ *        Comparing them as integers orders events consistently with causality across nodes,
+ *        even when their clocks disagree by a few milliseconds or a sync steps one clock backwards.
+ */
+using hlc_t = uint64_t;
+
+/**
+ * @brief Returns the HLC timestamp of a local event or a message to send. Each call returns a larger value than the previous one. @n
+ *        Safe to call from several tasks: a critical section of a few instructions guards the last timestamp.
+ */
+hlc_t hlcNow();
+
+/**
+ * @brief Merges the HLC timestamp of a received message, and returns the timestamp of the receive event (larger than both). @n
+ *        Remote timestamps ahead of the local clock by more than 60 seconds (@c PFTIME_HLC_MAX_AHEAD_MS) are not adopted,
+ *        so that a node with a wrong clock doesn't drag the others forward.
+ * 
+ * @param remote  The timestamp carried by the message
+ */
+hlc_t hlcUpdate(hlc_t remote);
+
+/**
+ * @brief Converts the physical part of a HLC timestamp into UNIX time (the logical counter is dropped).
+ * 
+ * @param hlc  The HLC timestamp
+ * @param tv   A pointer to store the time
+ */
+void hlcToTimeval(hlc_t hlc, struct timeval *tv);
+
 } // namespace pftime
 
 #endif // ESPPERFECTTIME_H_
\ No newline at end of file
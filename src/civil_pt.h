@@ -0,0 +1,88 @@
+#ifndef ESPPERFECTTIME_CIVIL_H_
+#define ESPPERFECTTIME_CIVIL_H_
+
+#include <time.h>
+
+#define CIVIL_SECS_PER_DAY 86400
+
+namespace pftime_civil {
+
+/**
+ * Days since 1970-01-01 of given proleptic Gregorian date.
+ * (month is 1-12, see http://howardhinnant.github.io/date_algorithms.html)
+ */
+static inline long days_from_civil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const long     era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (long)doe - 719468;
+}
+
+/**
+ * Inverse of days_from_civil().
+ */
+static inline void civil_from_days(long z, int *y, unsigned *m, unsigned *d) {
+  z += 719468;
+  const long     era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp  = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = (int)(yoe + era * 400) + (*m <= 2);
+}
+
+static inline bool is_leap_year(int y) {
+  return ((y % 4) == 0 && (y % 100) != 0) || (y % 400) == 0;
+}
+
+/**
+ * Day of week (0 = Sunday) of given days since 1970-01-01 (Thursday).
+ */
+static inline int weekday(long days) {
+  int w = (int)((days + 4) % 7);
+  return w < 0 ? w + 7 : w;
+}
+
+/**
+ * Split UNIX time into days and seconds of the day, rounding toward minus infinity.
+ */
+static inline long split_days(time_t t, long *secs_of_day) {
+  long days = (long)(t / CIVIL_SECS_PER_DAY);
+  long secs = (long)(t % CIVIL_SECS_PER_DAY);
+  if (secs < 0) {
+    secs += CIVIL_SECS_PER_DAY;
+    days--;
+  }
+  *secs_of_day = secs;
+  return days;
+}
+
+/**
+ * Same as gmtime_r(), without any locking or TZ lookup.
+ */
+static inline struct tm *to_tm(time_t t, struct tm *tm) {
+  long     secs;
+  long     days = split_days(t, &secs);
+  int      y;
+  unsigned m, d;
+  civil_from_days(days, &y, &m, &d);
+
+  tm->tm_year  = y - 1900;
+  tm->tm_mon   = (int)m - 1;
+  tm->tm_mday  = (int)d;
+  tm->tm_hour  = (int)(secs / 3600);
+  tm->tm_min   = (int)(secs / 60 % 60);
+  tm->tm_sec   = (int)(secs % 60);
+  tm->tm_wday  = weekday(days);
+  tm->tm_yday  = (int)(days - days_from_civil(y, 1, 1));
+  tm->tm_isdst = 0;
+  return tm;
+}
+
+} // namespace pftime_civil
+
+#endif // ESPPERFECTTIME_CIVIL_H_
@@ -0,0 +1,182 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <sys/time.h>
+#ifdef ESP32
+#include <esp_timer.h>
+#endif // ESP32
+#include "ESPPerfectTime.h"
+#include <fast_pt.h>
+#include <stamp_pt.h>
+
+#define USECS_PER_SEC 1000000LL
+
+/**
+ * ESP8266 uses CCOUNT, which wraps every 2^32 cycles (26.8 seconds at 160 MHz),
+ * so the anchor must be refreshed before half of it elapses.
+ * ESP32 uses esp_timer instead, because CCOUNT differs between the cores and
+ * its rate changes with dynamic frequency scaling.
+ * On both the age of the anchor is also checked on the 64-bit monotonic counter,
+ * because CCOUNT can wrap any number of times while nothing reads the clock.
+ */
+#ifdef ESP8266
+#define FAST_MAX_TICKS 0x80000000UL
+#endif // ESP8266
+
+#define FAST_MAX_AGE_US ((int64_t)PFTIME_FAST_MAX_AGE_MS * 1000)
+
+// Keeps the microseconds since the anchor in 32 bits
+#if PFTIME_FAST_MAX_AGE_MS > 2000000
+#error "PFTIME_FAST_MAX_AGE_MS must not exceed 2000000"
+#endif
+
+/** Rate differences between the system clock and the counter larger than this (in ppm) are regarded as steps */
+#define FAST_MAX_RATE_PPM 1000
+
+namespace pftime_fast {
+
+/** System clock at a counter value */
+struct fast_anchor {
+  time_t   sec;       // split like struct timeval, so that reads carry the microseconds without dividing
+  uint32_t usec;
+  int64_t  mono_us;   // monotonic counter at the anchor, to check the age and to measure the rate
+#ifdef ESP8266
+  uint32_t ticks;     // CCOUNT
+  uint32_t mult;      // microseconds per tick in 0.32 fixed point
+  uint32_t max_ticks; // stale after this
+#endif // ESP8266
+  int32_t  rate;      // rate of the system clock relative to the counter, minus 1, in 0.32 fixed point
+};
+
+static bool               _enabled;
+static struct fast_anchor _anchor;
+static volatile uint32_t  _anchor_seq; // odd while being updated, 0 if never anchored
+static volatile bool      _stale;
+
+#ifdef ESP8266
+static inline uint32_t get_ticks(void) {
+  return ESP.getCycleCount();
+}
+#endif // ESP8266
+
+/**
+ * Become the only writer of the anchor: make the even sequence number odd.
+ */
+static bool claim(uint32_t *seq) {
+#ifdef ESP8266
+  // Single core: masking interrupts is cheaper than emulated atomics
+  uint32_t saved = xt_rsil(15);
+  uint32_t s     = _anchor_seq;
+  bool     ok    = (s & 1) == 0;
+  if (ok)
+    _anchor_seq = s + 1;
+  xt_wsr_ps(saved);
+#else
+  uint32_t s  = __atomic_load_n(&_anchor_seq, __ATOMIC_RELAXED);
+  bool     ok = (s & 1) == 0 && __atomic_compare_exchange_n(&_anchor_seq, &s, s + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+  *seq = s;
+  return ok;
+}
+
+static void anchor(struct timeval *tv) {
+  uint32_t seq;
+  if (!claim(&seq)) {
+    // Another task (e.g. on the other core) is re-anchoring: take the slow path this time
+    ::gettimeofday(tv, nullptr);
+    return;
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  // Cleared before reading the clock, so that a settimeofday() meanwhile makes it stale again
+  bool stepped = _stale || seq == 0;
+  _stale       = false;
+
+  struct fast_anchor a;
+#ifdef ESP8266
+  uint32_t before = get_ticks();
+  ::gettimeofday(tv, nullptr);
+  uint32_t after = get_ticks();
+  a.mono_us      = pftime_stamp::monotonic_us();
+
+  uint32_t mhz     = ESP.getCpuFreqMHz();
+  uint64_t max_age = (uint64_t)PFTIME_FAST_MAX_AGE_MS * 1000 * mhz;
+  a.ticks          = before + (after - before) / 2;
+  a.mult           = (uint32_t)(0x100000000ULL / mhz);
+  a.max_ticks      = max_age < FAST_MAX_TICKS ? (uint32_t)max_age : FAST_MAX_TICKS;
+#else
+  int64_t before = pftime_stamp::monotonic_us();
+  ::gettimeofday(tv, nullptr);
+  int64_t after = pftime_stamp::monotonic_us();
+  a.mono_us     = before + (after - before) / 2;
+#endif
+  a.sec  = tv->tv_sec;
+  a.usec = (uint32_t)tv->tv_usec;
+
+  // The system clock may run at another rate than the counter (e.g. while adjtime() slews it):
+  // measure it since the previous anchor, unless the clock was set meanwhile
+  a.rate = 0;
+  if (!stepped) {
+    int64_t interval = a.mono_us - _anchor.mono_us;
+    int64_t diff     = ((int64_t)(a.sec - _anchor.sec) * USECS_PER_SEC + a.usec - _anchor.usec) - interval;
+    if (interval < FAST_MAX_AGE_US / 2)
+      a.rate = _anchor.rate; // too short to measure
+    else if (diff * 1000000 / FAST_MAX_RATE_PPM <= interval && -diff * 1000000 / FAST_MAX_RATE_PPM <= interval)
+      a.rate = (int32_t)(diff * 0x100000000LL / interval);
+  }
+
+  _anchor = a;
+  __atomic_store_n(&_anchor_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void setenabled(bool enabled) {
+  _enabled = enabled;
+  invalidate();
+}
+
+void invalidate(void) {
+  _stale = true;
+}
+
+bool read(struct timeval *tv) {
+  if (!_enabled)
+    return false;
+
+  uint32_t           seq = __atomic_load_n(&_anchor_seq, __ATOMIC_ACQUIRE);
+  struct fast_anchor a   = _anchor;
+  int64_t            age = pftime_stamp::monotonic_us() - a.mono_us;
+#ifdef ESP8266
+  uint32_t elapsed = get_ticks() - a.ticks; // wraps correctly as long as the anchor is fresh
+#endif
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  if (seq == 0 || (seq & 1) != 0 || _stale || seq != __atomic_load_n(&_anchor_seq, __ATOMIC_RELAXED) || age < 0 ||
+      age > FAST_MAX_AGE_US
+#ifdef ESP8266
+      || elapsed > a.max_ticks
+#endif
+  ) {
+    anchor(tv);
+    return true;
+  }
+
+  // 32-bit arithmetic from here on, apart from widening multiplications: no division
+#ifdef ESP8266
+  uint32_t us = (uint32_t)(((uint64_t)elapsed * a.mult) >> 32); // finer than the monotonic counter
+#else
+  uint32_t us = (uint32_t)age;
+#endif
+  if (a.rate != 0)
+    us += (int32_t)(((int64_t)us * a.rate) >> 32);
+
+  time_t   sec  = a.sec;
+  uint32_t usec = a.usec + us;
+  while (usec >= USECS_PER_SEC) {
+    usec -= USECS_PER_SEC;
+    sec++;
+  }
+  tv->tv_sec  = sec;
+  tv->tv_usec = (suseconds_t)usec;
+  return true;
+}
+
+} // namespace pftime_fast
@@ -0,0 +1,34 @@
+#ifndef ESPPERFECTTIME_FAST_H_
+#define ESPPERFECTTIME_FAST_H_
+
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+
+/** The anchor is refreshed from the system clock when it is older than this (in milliseconds, up to 2000000) */
+#ifndef PFTIME_FAST_MAX_AGE_MS
+#define PFTIME_FAST_MAX_AGE_MS 1000
+#endif
+
+namespace pftime_fast {
+
+/**
+ * Enable or disable the fast clock. While disabled read() always fails.
+ */
+void setenabled(bool enabled);
+
+/**
+ * Forget the anchor (e.g. because the system clock was set).
+ */
+void invalidate(void);
+
+/**
+ * Read the system clock from the hardware counter and the anchor,
+ * without calling ::gettimeofday() unless the anchor is stale.
+ *
+ * @return false when disabled
+ */
+bool read(struct timeval *tv);
+
+} // namespace pftime_fast
+
+#endif // ESPPERFECTTIME_FAST_H_
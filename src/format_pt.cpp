@@ -0,0 +1,178 @@
+#include <Arduino.h>
+#include <time.h>
+#include "ESPPerfectTime.h"
+#include <civil_pt.h>
+#include <format_pt.h>
+
+namespace pftime_format {
+
+static const char _digit_pairs[200] PROGMEM = {
+  '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+  '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+  '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+  '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+  '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+  '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+  '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+  '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+  '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+  '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9',
+};
+
+/** Emit 2 digits of n (0-99) */
+static inline char *put2(char *p, unsigned n) {
+  p[0] = (char)pgm_read_byte(&_digit_pairs[n * 2]);
+  p[1] = (char)pgm_read_byte(&_digit_pairs[n * 2 + 1]);
+  return p + 2;
+}
+
+size_t rfc3339(char *buf, size_t len, time_t t, suseconds_t usec, bool leap_sec, long offset, int flags) {
+  bool   local  = (flags & RFC3339_LOCAL) != 0;
+  size_t digits = (flags & RFC3339_MICROS) ? 6 : (flags & RFC3339_MILLIS) ? 3 : 0;
+  size_t need   = 19 + (digits ? digits + 1 : 0) + (local ? 6 : 1);
+  if (buf == nullptr || len <= need || usec < 0 || usec >= 1000000)
+    return 0;
+
+  long     secs;
+  int      y;
+  unsigned m, d;
+  pftime_civil::civil_from_days(pftime_civil::split_days(t + (local ? offset : 0), &secs), &y, &m, &d);
+  if (y < 0 || y > 9999)
+    return 0;
+
+  char *p = buf;
+  p    = put2(p, (unsigned)y / 100);
+  p    = put2(p, (unsigned)y % 100);
+  *p++ = '-';
+  p    = put2(p, m);
+  *p++ = '-';
+  p    = put2(p, d);
+  *p++ = 'T';
+  p    = put2(p, (unsigned)(secs / 3600));
+  *p++ = ':';
+  p    = put2(p, (unsigned)(secs / 60 % 60));
+  *p++ = ':';
+  p    = put2(p, leap_sec ? 60 : (unsigned)(secs % 60));
+
+  if (digits == 6) {
+    *p++ = '.';
+    p    = put2(p, (unsigned)usec / 10000);
+    p    = put2(p, (unsigned)usec / 100 % 100);
+    p    = put2(p, (unsigned)usec % 100);
+  } else if (digits == 3) {
+    unsigned ms = (unsigned)usec / 1000;
+    *p++        = '.';
+    *p++        = (char)('0' + ms / 100);
+    p           = put2(p, ms % 100);
+  }
+
+  if (local) {
+    unsigned abs_offset = (unsigned)(offset < 0 ? -offset : offset) / 60;
+    *p++                = offset < 0 ? '-' : '+';
+    p                   = put2(p, abs_offset / 60 % 100);
+    *p++                = ':';
+    p                   = put2(p, abs_offset % 60);
+  } else {
+    *p++ = 'Z';
+  }
+  *p = '\0';
+  return (size_t)(p - buf);
+}
+
+/** Read n digits */
+static bool get_digits(const char **p, int n, int *result) {
+  int v = 0;
+  for (int i = 0; i < n; i++) {
+    char c = (*p)[i];
+    if (c < '0' || c > '9')
+      return false;
+    v = v * 10 + (c - '0');
+  }
+  *p += n;
+  *result = v;
+  return true;
+}
+
+static inline bool get_char(const char **p, char c) {
+  if (**p != c)
+    return false;
+  (*p)++;
+  return true;
+}
+
+size_t parse_rfc3339(const char *str, struct timeval *tv, bool *leap_sec) {
+  static const uint8_t mdays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+  if (str == nullptr || tv == nullptr)
+    return 0;
+
+  const char *p = str;
+  int         y, mon, d, h, min, sec;
+  if (!get_digits(&p, 4, &y) || !get_char(&p, '-') ||
+      !get_digits(&p, 2, &mon) || !get_char(&p, '-') ||
+      !get_digits(&p, 2, &d))
+    return 0;
+  if (*p != 'T' && *p != 't' && *p != ' ')
+    return 0;
+  p++;
+  if (!get_digits(&p, 2, &h) || !get_char(&p, ':') ||
+      !get_digits(&p, 2, &min) || !get_char(&p, ':') ||
+      !get_digits(&p, 2, &sec))
+    return 0;
+
+  int last = mon >= 1 && mon <= 12 ? mdays[mon - 1] + (mon == 2 && pftime_civil::is_leap_year(y) ? 1 : 0) : 0;
+  if (d < 1 || d > last || h > 23 || min > 59 || sec > 60)
+    return 0;
+
+  // Fraction: any number of digits, truncated to microseconds
+  long usec = 0;
+  if (*p == '.') {
+    p++;
+    if (*p < '0' || *p > '9')
+      return 0;
+    long scale = 100000;
+    for (; *p >= '0' && *p <= '9'; p++) {
+      usec += (*p - '0') * scale;
+      scale /= 10;
+    }
+  }
+
+  long offset;
+  if (*p == 'Z' || *p == 'z') {
+    offset = 0;
+    p++;
+  } else if (*p == '+' || *p == '-') {
+    int sign = *p++ == '-' ? -1 : 1;
+    int oh, om;
+    if (!get_digits(&p, 2, &oh))
+      return 0;
+    get_char(&p, ':'); // also accept ISO 8601 basic format "+hhmm"
+    if (!get_digits(&p, 2, &om) || oh > 23 || om > 59)
+      return 0;
+    offset = sign * (oh * 3600L + om * 60L);
+  } else {
+    return 0;
+  }
+
+  time_t t = (time_t)pftime_civil::days_from_civil(y, (unsigned)mon, (unsigned)d) * CIVIL_SECS_PER_DAY
+           + h * 3600L + min * 60L + (sec == 60 ? 59 : sec) - offset;
+
+  if (sec == 60) {
+    // A leap second is allowed only at 23:59:60 UTC of the last day of a month
+    long     secs;
+    int      uy;
+    unsigned um, ud;
+    pftime_civil::civil_from_days(pftime_civil::split_days(t, &secs), &uy, &um, &ud);
+    int ulast = mdays[um - 1] + (um == 2 && pftime_civil::is_leap_year(uy) ? 1 : 0);
+    if (secs != CIVIL_SECS_PER_DAY - 1 || (int)ud != ulast)
+      return 0;
+  }
+
+  tv->tv_sec  = t;
+  tv->tv_usec = (suseconds_t)usec;
+  if (leap_sec)
+    *leap_sec = sec == 60;
+  return (size_t)(p - str);
+}
+
+} // namespace pftime_format
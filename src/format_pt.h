@@ -0,0 +1,33 @@
+#ifndef ESPPERFECTTIME_FORMAT_H_
+#define ESPPERFECTTIME_FORMAT_H_
+
+#include <stddef.h>
+#include <sys/time.h>
+#include <time.h>
+#include "ESPPerfectTime.h"
+
+namespace pftime_format {
+
+/**
+ * Write RFC 3339 timestamp into buf.
+ *
+ * @param t        UNIX time (23:59:59 for an inserted leap second)
+ * @param usec     Microseconds part
+ * @param leap_sec Whether t is in an inserted leap second (printed as 23:59:60)
+ * @param offset   Local time offset from UTC (in seconds, positive to east), used with RFC3339_LOCAL
+ * @param flags    RFC3339_* flags
+ * @return number of characters written (excluding the null character), or 0 when failure
+ */
+size_t rfc3339(char *buf, size_t len, time_t t, suseconds_t usec, bool leap_sec, long offset, int flags);
+
+/**
+ * Parse RFC 3339 timestamp.
+ * An inserted leap second (23:59:60 in UTC at the end of a month) is stored as 23:59:59.
+ *
+ * @return number of characters parsed, or 0 when failure
+ */
+size_t parse_rfc3339(const char *str, struct timeval *tv, bool *leap_sec);
+
+} // namespace pftime_format
+
+#endif // ESPPERFECTTIME_FORMAT_H_
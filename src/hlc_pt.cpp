@@ -0,0 +1,71 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <sys/time.h>
+#ifndef ESP8266
+#include <freertos/FreeRTOS.h>
+#endif
+#include "ESPPerfectTime.h"
+#include <hlc_pt.h>
+
+#define USECS_PER_SEC 1000000ULL
+#define HLC_LOGICAL_BITS 16
+#define HLC_FRAC_PER_SEC (1ULL << 16)
+
+namespace pftime_hlc {
+
+static uint64_t _last; // the last timestamp given
+#ifndef ESP8266
+static portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+// UNIX time in 1/65536 seconds, shifted to the physical part
+static inline uint64_t physical(const struct timeval *tv) {
+  uint64_t frac = ((uint64_t)tv->tv_usec << 16) / USECS_PER_SEC;
+  return (((uint64_t)(uint32_t)tv->tv_sec << 16) | frac) << HLC_LOGICAL_BITS;
+}
+
+/**
+ * Give a timestamp later than the last one, and not earlier than floor.
+ * The logical counter carries into the physical part when it overflows, which keeps the order.
+ */
+static uint64_t advance(uint64_t floor) {
+#ifdef ESP8266
+  // Single core: masking interrupts is cheaper than emulated atomics
+  uint32_t saved = xt_rsil(15);
+#else
+  // No 64-bit compare-and-swap on the ESP32s (libatomic would take a lock anyway)
+  portENTER_CRITICAL(&_lock);
+#endif
+  uint64_t next = _last + 1;
+  if (next < floor)
+    next = floor;
+  _last = next;
+#ifdef ESP8266
+  xt_wsr_ps(saved);
+#else
+  portEXIT_CRITICAL(&_lock);
+#endif
+  return next;
+}
+
+uint64_t now(const struct timeval *tv) {
+  return advance(physical(tv));
+}
+
+uint64_t update(const struct timeval *tv, uint64_t remote) {
+  uint64_t pt    = physical(tv);
+  uint64_t limit = pt + (((uint64_t)PFTIME_HLC_MAX_AHEAD_MS * HLC_FRAC_PER_SEC / 1000) << HLC_LOGICAL_BITS);
+
+  // A node with a wrong clock must not drag the others forward
+  if (remote < limit && remote + 1 > pt)
+    pt = remote + 1;
+  return advance(pt);
+}
+
+void totimeval(uint64_t hlc, struct timeval *tv) {
+  uint64_t pt = hlc >> HLC_LOGICAL_BITS;
+  tv->tv_sec  = (time_t)(pt >> 16);
+  tv->tv_usec = (suseconds_t)(((pt & (HLC_FRAC_PER_SEC - 1)) * USECS_PER_SEC) >> 16);
+}
+
+} // namespace pftime_hlc
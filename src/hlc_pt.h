@@ -0,0 +1,36 @@
+#ifndef ESPPERFECTTIME_HLC_H_
+#define ESPPERFECTTIME_HLC_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+
+/** Remote timestamps ahead of the local clock by more than this (in milliseconds) are not adopted */
+#ifndef PFTIME_HLC_MAX_AHEAD_MS
+#define PFTIME_HLC_MAX_AHEAD_MS 60000
+#endif
+
+namespace pftime_hlc {
+
+/**
+ * Timestamp for a local or send event.
+ *
+ * @param tv the current time
+ */
+uint64_t now(const struct timeval *tv);
+
+/**
+ * Timestamp for a receive event, later than both the local clock and the remote timestamp.
+ *
+ * @param tv the current time
+ */
+uint64_t update(const struct timeval *tv, uint64_t remote);
+
+/**
+ * Physical part of the timestamp.
+ */
+void totimeval(uint64_t hlc, struct timeval *tv);
+
+} // namespace pftime_hlc
+
+#endif // ESPPERFECTTIME_HLC_H_
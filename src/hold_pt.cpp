@@ -0,0 +1,148 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+#include <hold_pt.h>
+#include <stamp_pt.h>
+
+#define USECS_PER_SEC 1000000LL
+
+namespace pftime_hold {
+
+/** What is known about the clock at the last sync */
+struct hold_anchor {
+  int64_t  sync_us;  // monotonic counter at the last sync
+  int64_t  due_us;   // the clock is free-running after sync_us + due_us
+  uint32_t base_us;  // error just after the sync (half of the round-trip delay)
+  int32_t  ppb;      // frequency estimate
+  bool     synced;
+  bool     has_freq;
+};
+
+static struct hold_anchor             _anchor;
+static volatile uint32_t              _anchor_seq; // odd while being updated
+static volatile uint32_t              _state = CLOCK_STATE_UNSYNCHRONIZED;
+static pftime::clock_state_callback_t _cb;
+
+static void load(struct hold_anchor *a) {
+  uint32_t seq;
+  do {
+    seq = __atomic_load_n(&_anchor_seq, __ATOMIC_ACQUIRE);
+    *a  = _anchor;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) != 0 || seq != __atomic_load_n(&_anchor_seq, __ATOMIC_RELAXED));
+}
+
+/**
+ * Change the state from the expected one. Only the caller which succeeded invokes the callback.
+ */
+static bool change(uint32_t from, uint32_t to) {
+#ifdef ESP8266
+  // Single core: masking interrupts is cheaper than emulated atomics
+  uint32_t saved = xt_rsil(15);
+  bool     ok    = _state == from;
+  if (ok)
+    _state = to;
+  xt_wsr_ps(saved);
+#else
+  bool ok = __atomic_compare_exchange_n(&_state, &from, to, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+  if (ok && _cb != nullptr)
+    _cb((uint8_t)to);
+  return ok;
+}
+
+static int64_t error_at(const struct hold_anchor *a, int64_t now) {
+  int64_t age = now - a->sync_us;
+  return a->base_us + age / USECS_PER_SEC * (a->has_freq ? PFTIME_HOLD_PHI_PPM : PFTIME_HOLD_RAW_PPM);
+}
+
+void onstart(void) {
+  change(CLOCK_STATE_UNSYNCHRONIZED, CLOCK_STATE_ACQUIRING);
+}
+
+void onsync(int64_t offset_us, int64_t rtt_us, uint32_t next_ms) {
+  int64_t            now = pftime_stamp::monotonic_us();
+  struct hold_anchor a   = _anchor; // only written here
+
+  // The offset since the last sync is how much the uncorrected clock drifted
+  int64_t elapsed = now - a.sync_us;
+  if (a.synced && elapsed >= PFTIME_HOLD_MIN_INTERVAL_MS * 1000LL && offset_us > -PFTIME_HOLD_MAX_STEP_US && offset_us < PFTIME_HOLD_MAX_STEP_US) {
+    int64_t ppb = offset_us * 1000000000LL / elapsed;
+    if (ppb > -PFTIME_HOLD_MAX_PPM * 1000LL && ppb < PFTIME_HOLD_MAX_PPM * 1000LL) {
+      a.ppb      = a.has_freq ? (int32_t)((a.ppb + ppb) / 2) : (int32_t)ppb;
+      a.has_freq = true;
+    }
+  }
+  a.sync_us = now;
+  a.due_us  = ((int64_t)next_ms + PFTIME_HOLD_GRACE_MS) * 1000;
+  a.base_us = rtt_us > 0 ? (uint32_t)(rtt_us / 2) : 0;
+  a.synced  = true;
+
+  uint32_t seq = _anchor_seq;
+  __atomic_store_n(&_anchor_seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  _anchor = a;
+  __atomic_store_n(&_anchor_seq, seq + 2, __ATOMIC_RELEASE);
+
+  uint32_t state;
+  do {
+    state = _state;
+  } while (state != CLOCK_STATE_LOCKED && !change(state, CLOCK_STATE_LOCKED));
+}
+
+uint8_t check(void) {
+  uint32_t state = _state;
+  if (state != CLOCK_STATE_LOCKED && state != CLOCK_STATE_HOLDOVER)
+    return (uint8_t)state;
+
+  struct hold_anchor a;
+  load(&a);
+  int64_t now = pftime_stamp::monotonic_us();
+
+  if (state == CLOCK_STATE_LOCKED && now - a.sync_us > a.due_us && change(state, CLOCK_STATE_HOLDOVER))
+    state = CLOCK_STATE_HOLDOVER;
+  if (state == CLOCK_STATE_HOLDOVER && error_at(&a, now) > PFTIME_HOLD_MAX_ERROR_US && change(state, CLOCK_STATE_EXPIRED))
+    state = CLOCK_STATE_EXPIRED;
+  return (uint8_t)_state;
+}
+
+uint32_t error(void) {
+  struct hold_anchor a;
+  load(&a);
+  if (!a.synced)
+    return UINT32_MAX;
+
+  int64_t err = error_at(&a, pftime_stamp::monotonic_us());
+  return err < UINT32_MAX ? (uint32_t)err : UINT32_MAX;
+}
+
+int32_t frequency(void) {
+  struct hold_anchor a;
+  load(&a);
+  return a.has_freq ? a.ppb : 0;
+}
+
+void correct(struct timeval *tv) {
+  struct hold_anchor a;
+  load(&a);
+  if (!a.has_freq)
+    return;
+
+  // In milliseconds, to stay in 64 bits for a long holdover
+  int64_t elapsed_ms = (pftime_stamp::monotonic_us() - a.sync_us) / 1000;
+  int64_t usec       = (int64_t)tv->tv_usec + elapsed_ms * a.ppb / 1000000;
+  tv->tv_sec += (time_t)(usec / USECS_PER_SEC);
+  usec       %= USECS_PER_SEC;
+  if (usec < 0) {
+    usec += USECS_PER_SEC;
+    tv->tv_sec--;
+  }
+  tv->tv_usec = (suseconds_t)usec;
+}
+
+void setcallback(pftime::clock_state_callback_t cb) {
+  _cb = cb;
+}
+
+} // namespace pftime_hold
@@ -0,0 +1,88 @@
+#ifndef ESPPERFECTTIME_HOLD_H_
+#define ESPPERFECTTIME_HOLD_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+
+/** Margin (in milliseconds) after the expected next sync before the clock is regarded as free-running */
+#ifndef PFTIME_HOLD_GRACE_MS
+#define PFTIME_HOLD_GRACE_MS 60000
+#endif
+
+/** In holdover, the clock expires when its estimated error exceeds this (in microseconds) */
+#ifndef PFTIME_HOLD_MAX_ERROR_US
+#define PFTIME_HOLD_MAX_ERROR_US 1000000
+#endif
+
+/** Growth of the error (in PPM) while the frequency is corrected by the estimate, same as NTP's PHI */
+#ifndef PFTIME_HOLD_PHI_PPM
+#define PFTIME_HOLD_PHI_PPM 15
+#endif
+
+/** Growth of the error (in PPM) until the frequency is estimated (crystal tolerance) */
+#ifndef PFTIME_HOLD_RAW_PPM
+#define PFTIME_HOLD_RAW_PPM 50
+#endif
+
+/** Frequency estimates beyond this (in PPM) are regarded as bogus and discarded */
+#ifndef PFTIME_HOLD_MAX_PPM
+#define PFTIME_HOLD_MAX_PPM 500
+#endif
+
+/** Offsets larger than this (in microseconds) are treated as steps, not as drift */
+#ifndef PFTIME_HOLD_MAX_STEP_US
+#define PFTIME_HOLD_MAX_STEP_US 128000
+#endif
+
+/** Syncs closer than this (in milliseconds) are not used to estimate the frequency */
+#ifndef PFTIME_HOLD_MIN_INTERVAL_MS
+#define PFTIME_HOLD_MIN_INTERVAL_MS 60000
+#endif
+
+namespace pftime_hold {
+
+/**
+ * The SNTP client was started: unsynchronized -> acquiring.
+ */
+void onstart(void);
+
+/**
+ * The system clock was synced: -> locked. Also updates the frequency estimate.
+ *
+ * @param offset_us offset applied to the system clock
+ * @param rtt_us    round-trip delay (0 for broadcast)
+ * @param next_ms   interval until the next sync is expected
+ */
+void onsync(int64_t offset_us, int64_t rtt_us, uint32_t next_ms);
+
+/**
+ * Update the state by the elapsed time (locked -> holdover -> expired), invoking the callback on change.
+ *
+ * @return the current state (CLOCK_STATE_*)
+ */
+uint8_t check(void);
+
+/**
+ * Estimated error of the corrected clock (in microseconds; UINT32_MAX if never synced)
+ */
+uint32_t error(void);
+
+/**
+ * Frequency estimate (in PPB; positive if the system clock is slow), 0 until estimated
+ */
+int32_t frequency(void);
+
+/**
+ * Apply the frequency estimate to the time read from the system clock.
+ */
+void correct(struct timeval *tv);
+
+/**
+ * Set the callback invoked when the state changes.
+ */
+void setcallback(pftime::clock_state_callback_t cb);
+
+} // namespace pftime_hold
+
+#endif // ESPPERFECTTIME_HOLD_H_
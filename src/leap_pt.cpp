@@ -0,0 +1,226 @@
+#include <Arduino.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ESPPerfectTime.h"
+#include <leap_pt.h>
+
+/* number of seconds between 1900 and 1970 */
+#define DIFF_SEC_1900_1970 2208988800UL
+
+namespace pftime_leap {
+
+/**
+ * Known leap seconds, as of IERS Bulletin C 69.
+ * Each entry is the UNIX time when TAI - UTC becomes tai_offset.
+ */
+static pftime::leap_entry_t _table[PFTIME_LEAP_TABLE_SIZE] = {
+  {  63072000, 10}, // 1972-01-01
+  {  78796800, 11}, // 1972-07-01
+  {  94694400, 12}, // 1973-01-01
+  { 126230400, 13}, // 1974-01-01
+  { 157766400, 14}, // 1975-01-01
+  { 189302400, 15}, // 1976-01-01
+  { 220924800, 16}, // 1977-01-01
+  { 252460800, 17}, // 1978-01-01
+  { 283996800, 18}, // 1979-01-01
+  { 315532800, 19}, // 1980-01-01
+  { 362793600, 20}, // 1981-07-01
+  { 394329600, 21}, // 1982-07-01
+  { 425865600, 22}, // 1983-07-01
+  { 489024000, 23}, // 1985-07-01
+  { 567993600, 24}, // 1988-01-01
+  { 631152000, 25}, // 1990-01-01
+  { 662688000, 26}, // 1991-01-01
+  { 709948800, 27}, // 1992-07-01
+  { 741484800, 28}, // 1993-07-01
+  { 773020800, 29}, // 1994-07-01
+  { 820454400, 30}, // 1996-01-01
+  { 867715200, 31}, // 1997-07-01
+  { 915148800, 32}, // 1999-01-01
+  {1136073600, 33}, // 2006-01-01
+  {1230768000, 34}, // 2009-01-01
+  {1341100800, 35}, // 2012-07-01
+  {1435708800, 36}, // 2015-07-01
+  {1483228800, 37}, // 2017-01-01
+};
+static size_t _count = 28;
+
+/** The last entry of the built-in table: SNTP never adds a point before this */
+#define LEAP_BUILTIN_LAST 1483228800
+
+/** A leap second announced by SNTP, not yet confirmed by enough syncs */
+static time_t  _pending_point;
+static int     _pending_delta;
+static uint8_t _pending_count;
+
+/** The entry appended by observe() (0 if none), to be removed when withdrawn */
+static time_t _learned_point;
+
+/**
+ * Binary search: index of the last entry whose utc <= t (0 if none).
+ */
+static size_t find(time_t t) {
+  size_t lo = 0, hi = _count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) >> 1;
+    if (_table[mid].utc <= t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo > 0 ? lo - 1 : 0;
+}
+
+int offset(time_t utc) {
+  if (_count == 0)
+    return 0;
+  return _table[find(utc)].tai_offset;
+}
+
+time_t tai_to_utc(time_t tai) {
+  if (_count == 0)
+    return tai;
+
+  // Same search as find(), keyed on the TAI instant of each entry
+  size_t lo = 0, hi = _count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) >> 1;
+    if (_table[mid].utc + _table[mid].tai_offset <= tai)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  size_t i   = lo > 0 ? lo - 1 : 0;
+  time_t utc = tai - _table[i].tai_offset;
+
+  // Inside an inserted leap second: hold 23:59:59 as pftime::gettimeofday() does
+  if (i + 1 < _count && utc >= _table[i + 1].utc)
+    utc = _table[i + 1].utc - 1;
+  return utc;
+}
+
+static void append(time_t point, int delta) {
+  if (_count > 0 && point <= _table[_count - 1].utc)
+    return;
+  if (_count >= PFTIME_LEAP_TABLE_SIZE)
+    return;
+
+  int last                  = _count > 0 ? _table[_count - 1].tai_offset : 10;
+  _table[_count].utc        = point;
+  _table[_count].tai_offset = (int16_t)(last + delta);
+  _count++;
+  _learned_point = point;
+}
+
+void observe(time_t now, time_t point, int delta) {
+  if (point == 0) {
+    // Withdrawn (or taken effect): forget what isn't effective yet
+    if (_learned_point > now && _count > 0 && _table[_count - 1].utc == _learned_point)
+      _count--;
+    if (_learned_point > now)
+      _learned_point = 0;
+    _pending_point = 0;
+    _pending_count = 0;
+    return;
+  }
+  if (point <= LEAP_BUILTIN_LAST || point <= now)
+    return;
+
+  if (point == _pending_point && delta == _pending_delta) {
+    if (_pending_count < 255)
+      _pending_count++;
+  } else {
+    _pending_point = point;
+    _pending_delta = delta;
+    _pending_count = 1;
+  }
+  // A single (possibly wrong or spoofed) response mustn't change the table for the rest of uptime
+  if (_pending_count == PFTIME_LEAP_CONFIRMATIONS)
+    append(point, delta);
+}
+
+int settable(const pftime::leap_entry_t *table, size_t count) {
+  if (table == nullptr || count == 0 || count > PFTIME_LEAP_TABLE_SIZE)
+    return -1;
+  for (size_t i = 1; i < count; i++) {
+    if (table[i].utc <= table[i - 1].utc)
+      return -1;
+  }
+
+  memcpy(_table, table, count * sizeof(*table));
+  _count         = count;
+  _learned_point = 0;
+  return (int)count;
+}
+
+/**
+ * Parse an unsigned decimal number at list[*pos], skipping leading blanks.
+ */
+static bool parse_number(const char *list, size_t len, size_t *pos, uint32_t *result) {
+  size_t i = *pos;
+  while (i < len && (list[i] == ' ' || list[i] == '\t'))
+    i++;
+  if (i >= len || list[i] < '0' || list[i] > '9')
+    return false;
+
+  uint32_t n = 0;
+  while (i < len && list[i] >= '0' && list[i] <= '9') {
+    n = n * 10 + (uint32_t)(list[i] - '0');
+    i++;
+  }
+  *pos    = i;
+  *result = n;
+  return true;
+}
+
+/**
+ * Walk through "leap-seconds.list" data lines.
+ * If out is null pointer, only validates and counts entries.
+ */
+static int parse_list(const char *list, size_t len, pftime::leap_entry_t *out) {
+  size_t count = 0;
+  size_t pos   = 0;
+  time_t prev  = 0;
+
+  while (pos < len) {
+    size_t eol = pos;
+    while (eol < len && list[eol] != '\n')
+      eol++;
+
+    size_t   i = pos;
+    uint32_t ntp_sec, tai_offset;
+    if (list[i] != '#' && parse_number(list, eol, &i, &ntp_sec)) {
+      if (!parse_number(list, eol, &i, &tai_offset) || ntp_sec < DIFF_SEC_1900_1970)
+        return -1;
+
+      time_t utc = (time_t)(ntp_sec - DIFF_SEC_1900_1970);
+      if (count >= PFTIME_LEAP_TABLE_SIZE || (count > 0 && utc <= prev))
+        return -1;
+      if (out) {
+        out[count].utc        = utc;
+        out[count].tai_offset = (int16_t)tai_offset;
+      }
+      prev = utc;
+      count++;
+    }
+    pos = eol + 1;
+  }
+  return (int)count;
+}
+
+int loadlist(const char *list, size_t len) {
+  if (list == nullptr)
+    return -1;
+
+  // Validate first so that a broken list never clobbers the current table
+  int count = parse_list(list, len, nullptr);
+  if (count <= 0)
+    return -1;
+
+  parse_list(list, len, _table);
+  _count         = (size_t)count;
+  _learned_point = 0;
+  return count;
+}
+
+} // namespace pftime_leap
@@ -0,0 +1,60 @@
+#ifndef ESPPERFECTTIME_LEAP_H_
+#define ESPPERFECTTIME_LEAP_H_
+
+#include <stddef.h>
+#include <time.h>
+#include "ESPPerfectTime.h"
+
+/** Maximum number of entries the leap second table can hold */
+#ifndef PFTIME_LEAP_TABLE_SIZE
+#define PFTIME_LEAP_TABLE_SIZE 40
+#endif
+
+/** Number of syncs which must announce a leap second before it's added to the table */
+#ifndef PFTIME_LEAP_CONFIRMATIONS
+#define PFTIME_LEAP_CONFIRMATIONS 2
+#endif
+
+namespace pftime_leap {
+
+/**
+ * Get TAI - UTC (in seconds) which is effective at given UTC time.
+ * Times before the first entry are clamped to the first entry.
+ */
+int offset(time_t utc);
+
+/**
+ * Convert TAI (seconds since 1970-01-01 00:00:00 TAI) to UNIX time.
+ * An inserted leap second is expressed as 23:59:59 repeated.
+ */
+time_t tai_to_utc(time_t tai);
+
+/**
+ * Track leap seconds announced by SNTP (LI bits), called on every sync.
+ * A leap second is appended to the table once PFTIME_LEAP_CONFIRMATIONS syncs
+ * have announced it, and removed again if a later sync withdraws it before it takes effect.
+ * Points not after the built-in table are ignored.
+ *
+ * @param now   UNIX time of the sync
+ * @param point UNIX time when the new offset takes effect (00:00:00 of the next day), or 0 if none announced
+ * @param delta +1 for an inserted leap second, -1 for a deleted one
+ */
+void observe(time_t now, time_t point, int delta);
+
+/**
+ * Replace the table with given entries (must be sorted by utc).
+ *
+ * @return number of entries, or -1 when failure
+ */
+int settable(const pftime::leap_entry_t *table, size_t count);
+
+/**
+ * Replace the table with the content of an IERS/NIST "leap-seconds.list" file.
+ *
+ * @return number of entries, or -1 when failure
+ */
+int loadlist(const char *list, size_t len);
+
+} // namespace pftime_leap
+
+#endif // ESPPERFECTTIME_LEAP_H_
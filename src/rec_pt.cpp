@@ -0,0 +1,79 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include "ESPPerfectTime.h"
+#include <rec_pt.h>
+
+namespace pftime_rec {
+
+/** Single-producer (lwIP thread) / single-consumer (application) ring provided by the application */
+static pftime::sync_sample_t *volatile _ring;
+static volatile uint32_t              _ring_size;
+static volatile uint32_t              _head; // next position to write, only written by producer
+static volatile uint32_t              _tail; // next position to read, only written by consumer
+static volatile uint32_t              _dropped;
+
+static pftime::sample_sink_t _sink;
+static void                 *_sink_ctx;
+
+void setring(pftime::sync_sample_t *ring, size_t count) {
+  // Detach first, so that record() never sees the new ring with the old size
+  __atomic_store_n(&_ring, (pftime::sync_sample_t *)nullptr, __ATOMIC_RELEASE);
+  if (ring == nullptr || count < 2)
+    return;
+
+  _ring_size = (uint32_t)count;
+  _head      = 0;
+  _tail      = 0;
+  _dropped   = 0;
+  __atomic_store_n(&_ring, ring, __ATOMIC_RELEASE);
+}
+
+void setsink(pftime::sample_sink_t sink, void *ctx) {
+  _sink_ctx = ctx;
+  _sink     = sink;
+}
+
+bool enabled(void) {
+  return _ring != nullptr || _sink != nullptr;
+}
+
+void record(const pftime::sync_sample_t *sample) {
+  pftime::sample_sink_t sink = _sink;
+  if (sink != nullptr)
+    sink(sample, _sink_ctx);
+
+  pftime::sync_sample_t *ring = __atomic_load_n(&_ring, __ATOMIC_ACQUIRE);
+  if (ring == nullptr)
+    return;
+
+  uint32_t head = _head;
+  uint32_t next = (head + 1) % _ring_size;
+  if (next == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE)) {
+    // ring is full: drop the newest
+    _dropped++;
+    return;
+  }
+  ring[head] = *sample;
+  __atomic_store_n(&_head, next, __ATOMIC_RELEASE);
+}
+
+size_t take(pftime::sync_sample_t *results, size_t count) {
+  pftime::sync_sample_t *ring = __atomic_load_n(&_ring, __ATOMIC_ACQUIRE);
+  if (ring == nullptr)
+    return 0;
+
+  size_t   n    = 0;
+  uint32_t tail = _tail;
+  while (n < count && tail != __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) {
+    results[n++] = ring[tail];
+    tail         = (tail + 1) % _ring_size;
+    __atomic_store_n(&_tail, tail, __ATOMIC_RELEASE);
+  }
+  return n;
+}
+
+uint32_t getdropped(void) {
+  return _dropped;
+}
+
+} // namespace pftime_rec
@@ -0,0 +1,44 @@
+#ifndef ESPPERFECTTIME_REC_H_
+#define ESPPERFECTTIME_REC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ESPPerfectTime.h"
+
+namespace pftime_rec {
+
+/**
+ * Record samples into the ring (nullptr to stop). Records not taken are dropped when it's full.
+ */
+void setring(pftime::sync_sample_t *ring, size_t count);
+
+/**
+ * Pass every sample to the sink (nullptr to stop), in lwIP thread.
+ */
+void setsink(pftime::sample_sink_t sink, void *ctx);
+
+/**
+ * Whether any ring or sink is set, to skip preparing samples otherwise.
+ */
+bool enabled(void);
+
+/**
+ * Record a sample. Called only from lwIP thread.
+ */
+void record(const pftime::sync_sample_t *sample);
+
+/**
+ * Take samples out of the ring. Only one task may call this.
+ *
+ * @return number of samples stored
+ */
+size_t take(pftime::sync_sample_t *results, size_t count);
+
+/**
+ * Number of samples dropped because the ring was full.
+ */
+uint32_t getdropped(void);
+
+} // namespace pftime_rec
+
+#endif // ESPPERFECTTIME_REC_H_
@@ -0,0 +1,217 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+#include <sched_pt.h>
+#include <stamp_pt.h>
+#include <tz_pt.h>
+
+#define USECS_PER_SEC  1000000LL
+#define USECS_PER_MSEC 1000LL
+
+/** Re-align periodic timers if the wall clock jumps more than this (in microseconds) */
+#ifndef SCHED_STEP_THRESHOLD_US
+#define SCHED_STEP_THRESHOLD_US 1000
+#endif
+
+namespace pftime_sched {
+
+struct sched_timer {
+  pftime::timer_callback_t cb;          // nullptr if unused
+  void                    *ctx;
+  int64_t                  deadline_us; // UNIX time (in microseconds)
+  uint32_t                 period_ms;   // 0 for one-shot
+  uint32_t                 phase_ms;
+  bool                     local;
+  uint8_t                  heap_pos;
+};
+
+static struct sched_timer _timers[SCHED_MAX_TIMERS];
+
+/** Min-heap of timer ids ordered by deadline */
+static uint8_t _heap[SCHED_MAX_TIMERS];
+static uint8_t _heap_size;
+
+/** Difference between the wall clock and the monotonic clock, to detect steps */
+static int64_t _last_skew_us;
+static bool    _skew_valid;
+
+static inline int64_t now_us(void) {
+  struct timeval tv;
+  pftime::gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * USECS_PER_SEC + tv.tv_usec;
+}
+
+static inline int64_t floor_div(int64_t a, int64_t b) {
+  int64_t q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+/**
+ * The first aligned instant after now.
+ */
+static int64_t next_aligned(const struct sched_timer *t, int64_t now) {
+  int64_t period = (int64_t)t->period_ms * USECS_PER_MSEC;
+  int64_t phase  = (int64_t)t->phase_ms * USECS_PER_MSEC;
+  int64_t offset = t->local ? pftime_tz::offset((time_t)(now / USECS_PER_SEC), nullptr) * USECS_PER_SEC : 0;
+
+  int64_t next = (floor_div(now + offset - phase, period) + 1) * period + phase;
+  if (t->local) {
+    // Use the offset at the deadline, so that DST transitions are taken into account
+    offset = pftime_tz::offset((time_t)((next - offset) / USECS_PER_SEC), nullptr) * USECS_PER_SEC;
+  }
+  return next - offset;
+}
+
+static inline bool heap_less(uint8_t a, uint8_t b) {
+  return _timers[_heap[a]].deadline_us < _timers[_heap[b]].deadline_us;
+}
+
+static inline void heap_swap(uint8_t a, uint8_t b) {
+  uint8_t id                 = _heap[a];
+  _heap[a]                   = _heap[b];
+  _heap[b]                   = id;
+  _timers[_heap[a]].heap_pos = a;
+  _timers[_heap[b]].heap_pos = b;
+}
+
+static void sift_up(uint8_t pos) {
+  while (pos > 0) {
+    uint8_t parent = (uint8_t)((pos - 1) / 2);
+    if (!heap_less(pos, parent))
+      break;
+    heap_swap(pos, parent);
+    pos = parent;
+  }
+}
+
+static void sift_down(uint8_t pos) {
+  for (;;) {
+    uint8_t least = pos;
+    uint8_t left  = (uint8_t)(pos * 2 + 1);
+    uint8_t right = (uint8_t)(pos * 2 + 2);
+    if (left < _heap_size && heap_less(left, least))
+      least = left;
+    if (right < _heap_size && heap_less(right, least))
+      least = right;
+    if (least == pos)
+      break;
+    heap_swap(pos, least);
+    pos = least;
+  }
+}
+
+static void heap_push(uint8_t id) {
+  uint8_t pos          = _heap_size++;
+  _heap[pos]           = id;
+  _timers[id].heap_pos = pos;
+  sift_up(pos);
+}
+
+static void heap_remove(uint8_t pos) {
+  _heap_size--;
+  if (pos != _heap_size) {
+    heap_swap(pos, _heap_size);
+    sift_down(pos);
+    sift_up(pos);
+  }
+}
+
+static int add(struct sched_timer *proto) {
+  if (proto->cb == nullptr)
+    return -1;
+  for (uint8_t id = 0; id < SCHED_MAX_TIMERS; id++) {
+    if (_timers[id].cb == nullptr) {
+      _timers[id] = *proto;
+      heap_push(id);
+      return id;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Re-align periodic timers after the wall clock stepped backward.
+ * Timers overtaken by a forward step simply fire once and are re-aligned in run().
+ */
+static void realign(int64_t now) {
+  for (uint8_t pos = 0; pos < _heap_size; pos++) {
+    struct sched_timer *t = &_timers[_heap[pos]];
+    if (t->period_ms == 0)
+      continue;
+    int64_t next = next_aligned(t, now);
+    if (t->deadline_us > next)
+      t->deadline_us = next;
+  }
+  for (int pos = _heap_size / 2 - 1; pos >= 0; pos--)
+    sift_down((uint8_t)pos);
+}
+
+int at(const struct timeval *when, pftime::timer_callback_t cb, void *ctx) {
+  if (when == nullptr)
+    return -1;
+
+  struct sched_timer t = {};
+  t.cb                 = cb;
+  t.ctx                = ctx;
+  t.deadline_us        = (int64_t)when->tv_sec * USECS_PER_SEC + when->tv_usec;
+  return add(&t);
+}
+
+int every(uint32_t period_ms, uint32_t phase_ms, pftime::timer_callback_t cb, void *ctx, bool local) {
+  if (period_ms == 0)
+    return -1;
+
+  struct sched_timer t = {};
+  t.cb                 = cb;
+  t.ctx                = ctx;
+  t.period_ms          = period_ms;
+  t.phase_ms           = phase_ms % period_ms;
+  t.local              = local;
+  t.deadline_us        = next_aligned(&t, now_us());
+  return add(&t);
+}
+
+void cancel(int id) {
+  if (id < 0 || id >= SCHED_MAX_TIMERS || _timers[id].cb == nullptr)
+    return;
+  heap_remove(_timers[id].heap_pos);
+  _timers[id].cb = nullptr;
+}
+
+uint32_t run(void) {
+  int64_t now  = now_us();
+  int64_t skew = now - pftime_stamp::monotonic_us();
+  if (_skew_valid && (skew - _last_skew_us > SCHED_STEP_THRESHOLD_US || _last_skew_us - skew > SCHED_STEP_THRESHOLD_US))
+    realign(now);
+  _last_skew_us = skew;
+  _skew_valid   = true;
+
+  while (_heap_size > 0 && _timers[_heap[0]].deadline_us <= now) {
+    uint8_t                  id  = _heap[0];
+    struct sched_timer      *t   = &_timers[id];
+    pftime::timer_callback_t cb  = t->cb;
+    void                    *ctx = t->ctx;
+
+    if (t->period_ms != 0) {
+      // Skip missed periods instead of firing them in a burst
+      t->deadline_us = next_aligned(t, now);
+      sift_down(0);
+    } else {
+      heap_remove(0);
+      t->cb = nullptr;
+    }
+
+    cb(ctx);
+    now = now_us();
+  }
+
+  if (_heap_size == 0)
+    return UINT32_MAX;
+  int64_t wait = _timers[_heap[0]].deadline_us - now;
+  if (wait < 0)
+    return 0;
+  return wait > (int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)wait;
+}
+
+} // namespace pftime_sched
@@ -0,0 +1,47 @@
+#ifndef ESPPERFECTTIME_SCHED_H_
+#define ESPPERFECTTIME_SCHED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+
+/** Max number of timers */
+#ifndef SCHED_MAX_TIMERS
+#define SCHED_MAX_TIMERS 8
+#endif
+
+namespace pftime_sched {
+
+/**
+ * Add a one-shot timer at given UNIX time.
+ *
+ * @return timer id, or -1 when failure
+ */
+int at(const struct timeval *when, pftime::timer_callback_t cb, void *ctx);
+
+/**
+ * Add a periodic timer aligned to the wall clock.
+ *
+ * @param period_ms period (in milliseconds)
+ * @param phase_ms  offset from the aligned instant (in milliseconds)
+ * @param local     align to local time instead of UTC
+ * @return timer id, or -1 when failure
+ */
+int every(uint32_t period_ms, uint32_t phase_ms, pftime::timer_callback_t cb, void *ctx, bool local);
+
+/**
+ * Remove the timer.
+ */
+void cancel(int id);
+
+/**
+ * Invoke callbacks of expired timers.
+ *
+ * @return microseconds until the next deadline (UINT32_MAX if no timer)
+ */
+uint32_t run(void);
+
+} // namespace pftime_sched
+
+#endif // ESPPERFECTTIME_SCHED_H_
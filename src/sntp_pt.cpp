@@ -39,15 +39,23 @@
 #include <lwip/def.h>
 #include <lwip/dns.h>
 #include <lwip/err.h>
+#include <lwip/igmp.h>
 #include <lwip/init.h>
 #include <lwip/ip_addr.h>
 #include <lwip/timeouts.h>
 #include <lwip/udp.h>
 #ifdef ESP8266
 #include <sntp-lwip2.h>
+#else // ESP8266
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <lwip/tcpip.h>
 #endif // ESP8266
 #include "ESPPerfectTime.h"
+#include <hold_pt.h>
+#include <rec_pt.h>
 #include <sntp_pt.h>
+#include <stamp_pt.h>
 
 #ifndef os_memset
 #define os_memset(s, c, n) memset(s, c, n)
@@ -141,6 +149,9 @@
 #ifndef SNTP_UPDATE_DELAY
 #define SNTP_UPDATE_DELAY           3600000
 #endif
+
+/** Minimum update delay (in milliseconds), as enforced by SNTPv4 RFC 4330 */
+#define SNTP_UPDATE_DELAY_MIN       15000
 // #if (SNTP_UPDATE_DELAY < 15000) && !SNTP_SUPPRESS_DELAY_CHECK
 // #error "SNTPv4 RFC 4330 enforces a minimum update time of 15 seconds!"
 // #endif
@@ -165,6 +176,165 @@
 #define SNTP_RETRY_TIMEOUT_EXP      1
 #endif
 
+/** Max random delay (in milliseconds) before the first request after init(),
+ * so that devices powered on together don't hit the servers at once.
+ * Default is 0 (send immediately).
+ */
+#ifndef SNTP_STARTUP_JITTER
+#define SNTP_STARTUP_JITTER         0
+#endif
+
+/** Randomize each update delay by +/- this percentage, so that the requests
+ * of many devices don't stay in lockstep.
+ */
+#ifndef SNTP_POLL_JITTER_PERCENT
+#define SNTP_POLL_JITTER_PERCENT    10
+#endif
+
+/** Time (in milliseconds) not to poll a server after Kiss-of-Death "RATE".
+ * This is doubled with each "RATE" from the server until SNTP_KOD_RATE_HOLD_MAX is reached,
+ * and the server is never polled more often than this afterwards.
+ */
+#ifndef SNTP_KOD_RATE_HOLD
+#define SNTP_KOD_RATE_HOLD          60000
+#endif
+
+/** Maximum time (in milliseconds) not to poll a server after Kiss-of-Death "RATE". Default is 1 day. */
+#ifndef SNTP_KOD_RATE_HOLD_MAX
+#define SNTP_KOD_RATE_HOLD_MAX      86400000
+#endif
+
+#ifndef LWIP_RAND
+#define LWIP_RAND()                 ((u32_t)rand())
+#endif
+
+/** Precision of our clock reported in server mode (log2 seconds, about 1 us) */
+#ifndef SNTP_SERVER_PRECISION
+#define SNTP_SERVER_PRECISION       -20
+#endif
+
+/** Frequency tolerance (in PPM) used to grow dispersion in server mode, same as NTP's PHI */
+#ifndef SNTP_SERVER_PHI_PPM
+#define SNTP_SERVER_PHI_PPM         15
+#endif
+
+/* The SNTP_SUPPORT_* switches below only trim features from the build, for all clients at once.
+ * Whether a client uses a feature is chosen at runtime, for each client: setinterleaved(),
+ * setdualstack(), and setoperatingmode() (the default client only, as it owns port 123). */
+
+/** Set this to 0 to drop the server mode (startserver()) from the build */
+#ifndef SNTP_SUPPORT_SERVER
+#define SNTP_SUPPORT_SERVER         1
+#endif
+
+/** Set this to 0 to drop the broadcast mode (SNTP_OPMODE_LISTENONLY) from the build */
+#ifndef SNTP_SUPPORT_BROADCAST
+#define SNTP_SUPPORT_BROADCAST      1
+#endif
+
+/** Set this to 0 to drop the interleaved mode (setinterleaved()) from the build */
+#ifndef SNTP_SUPPORT_INTERLEAVED
+#define SNTP_SUPPORT_INTERLEAVED    1
+#endif
+
+/** In interleaved mode, delay (in milliseconds) of the follow-up request which gets
+ * the precise transmit timestamp of the response to the previous one
+ * (no follow-up while the server holds us back longer with RATE) */
+#ifndef SNTP_INTERLEAVED_DELAY
+#define SNTP_INTERLEAVED_DELAY      2000
+#endif
+
+/** Previous exchanges older than this (in milliseconds) are not used in interleaved mode */
+#ifndef SNTP_INTERLEAVED_MAX_AGE
+#define SNTP_INTERLEAVED_MAX_AGE    8000
+#endif
+
+/** A server is polled in basic mode after this number of basic responses to interleaved requests */
+#ifndef SNTP_INTERLEAVED_MAX_FAILS
+#define SNTP_INTERLEAVED_MAX_FAILS  2
+#endif
+
+#if SNTP_SUPPORT_INTERLEAVED && SNTP_CHECK_RESPONSE < 2
+#error SNTP_SUPPORT_INTERLEAVED needs SNTP_CHECK_RESPONSE >= 2 to tell interleaved responses from basic ones
+#endif
+
+/** Resolve servers given by name to both IPv4 and IPv6 addresses, and race requests over them
+ * (set this to 0 to drop the race from the build; setdualstack() turns it off for a client) */
+#ifndef SNTP_SUPPORT_DUAL_STACK
+#define SNTP_SUPPORT_DUAL_STACK     (LWIP_IPV4 && LWIP_IPV6 && SNTP_SERVER_DNS)
+#endif
+
+/** Delay (in milliseconds) before a request is also sent over the other address family,
+ * if no response has come yet */
+#ifndef SNTP_RACE_DELAY
+#define SNTP_RACE_DELAY             250
+#endif
+
+/** Max wait (in milliseconds) for the address of the preferred family,
+ * once the one of the other family is resolved */
+#ifndef SNTP_RESOLUTION_DELAY
+#define SNTP_RESOLUTION_DELAY       50
+#endif
+
+/** Address families raced (0: IPv4, 1: IPv6) */
+#if SNTP_SUPPORT_DUAL_STACK
+#define SNTP_FAMILIES               2
+#else /* SNTP_SUPPORT_DUAL_STACK */
+#define SNTP_FAMILIES               1
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+#define SNTP_FAMILY_IPV4            0
+#define SNTP_FAMILY_IPV6            1
+#define SNTP_FAMILY_UNKNOWN         0xFF
+
+/** Operating modes, same as lwIP's sntp_setoperatingmode() */
+#ifndef SNTP_OPMODE_POLL
+#define SNTP_OPMODE_POLL            0
+#endif
+#ifndef SNTP_OPMODE_LISTENONLY
+#define SNTP_OPMODE_LISTENONLY      1
+#endif
+
+/** Max number of listeners added by addlistener() */
+#ifndef SNTP_MAX_LISTENERS
+#define SNTP_MAX_LISTENERS          4
+#endif
+
+/** Max number of clients made by newclient(), in addition to the default one */
+#ifndef SNTP_MAX_CLIENTS
+#define SNTP_MAX_CLIENTS            2
+#endif
+
+/** Minimum interval (in milliseconds) between requests, for those triggered by syncnow() */
+#ifndef SNTP_SYNC_NOW_MIN_INTERVAL
+#define SNTP_SYNC_NOW_MIN_INTERVAL  SNTP_UPDATE_DELAY_MIN
+#endif
+
+/** Max number of tasks waiting in waitsync() at once */
+#ifndef SNTP_MAX_WAITERS
+#define SNTP_MAX_WAITERS            4
+#endif
+
+/** Number of events which can be deferred until dispatch() (0 to drop setdeferred() from the build) */
+#ifndef SNTP_EVENT_QUEUE_SIZE
+#define SNTP_EVENT_QUEUE_SIZE       8
+#endif
+
+/** Number of entries of the trace ring of state transitions (a power of two; 0 to drop gettrace() from the build) */
+#ifndef SNTP_TRACE_SIZE
+#define SNTP_TRACE_SIZE             32
+#endif
+#if SNTP_TRACE_SIZE & (SNTP_TRACE_SIZE - 1)
+#error "SNTP_TRACE_SIZE must be a power of two"
+#endif
+
+/** Hooks to read and set the system clock, like lwIP's SNTP_GET_SYSTEM_TIME() and SNTP_SET_SYSTEM_TIME_US().
+ * Define them to drive this module with another clock (e.g. a virtual clock of a host-side simulator):
+ * - SNTP_GET_SYSTEM_TIME_US(sec, us)     stores the current time into u32_t lvalues sec and us
+ * - SNTP_SET_SYSTEM_TIME_US(sec, us, li) sets the time with the leap indicator li
+ */
+/* #define SNTP_GET_SYSTEM_TIME_US(sec, us) */
+/* #define SNTP_SET_SYSTEM_TIME_US(sec, us, li) */
+
 #define SNTP_ERR_KOD                1
 
 /* SNTP protocol defines */
@@ -183,6 +353,11 @@
 
 #define SNTP_OFFSET_STRATUM         1
 #define SNTP_STRATUM_KOD            0x00
+#define SNTP_STRATUM_MAX            15
+#define SNTP_STRATUM_UNSYNC         16
+
+#define SNTP_OFFSET_REFERENCE_ID    12
+#define SNTP_OFFSET_REFERENCE_TIME  16
 
 #define SNTP_OFFSET_ORIGINATE_TIME  24
 #define SNTP_OFFSET_RECEIVE_TIME    32
@@ -198,7 +373,14 @@
 #define UNIXSEC_TO_NTPSEC(sec)      (((sec) >= DIFF_SEC_1970_2036) ? ((sec) - DIFF_SEC_1970_2036) : ((sec) + DIFF_SEC_1900_1970))
 //#define NTPSEC_TO_UNIXSEC(sec)     ((((sec) & 0x80000000) == 0) ? ((sec) + DIFF_SEC_1970_2036) : ((sec) - DIFF_SEC_1900_1970))
 #define COMBINE_TO_USEC(sec, us)    ((sec) * USECS_IN_SEC + (us))
+#define USEC_TO_NTP_SHORT(us)       (u32_t)(((u64_t)(us) << 16) / USECS_IN_SEC)
 #define SEPARATE_USEC(us)           (u32_t)((us) / USECS_IN_SEC), (u32_t)((us) % USECS_IN_SEC)
+/* convert struct timeval into SNTP timestamp (network byte order) */
+#define TIMEVAL_TO_SNTP(tv, ts)                                              \
+  do {                                                                       \
+    (ts)[0] = htonl(UNIXSEC_TO_NTPSEC((u32_t)(tv)->tv_sec));                 \
+    (ts)[1] = htonl((u32_t)(((u64_t)(tv)->tv_usec << 32) / USECS_IN_SEC));   \
+  } while (0)
 
 #ifdef ESP32
 typedef uint8_t  uint8;
@@ -248,9 +430,10 @@ PACK_STRUCT_END
 
 /* function prototypes */
 static void request(void *arg);
-
-/** The UDP pcb used by the SNTP client */
-static struct udp_pcb *_sntp_pcb;
+#if SNTP_SUPPORT_DUAL_STACK
+static void race_next(void *arg);
+static void race_end(struct sntp_client *client);
+#endif /* SNTP_SUPPORT_DUAL_STACK */
 
 /** Names/Addresses of servers */
 struct sntp_server {
@@ -258,56 +441,248 @@ struct sntp_server {
   const char *name;
 #endif /* SNTP_SERVER_DNS */
   ip_addr_t addr;
+  /** Not polled until sys_now() reaches this, after Kiss-of-Death "RATE" */
+  u32_t hold_until;
+  /** Current hold time after "RATE" (0 if never received) */
+  u32_t rate_hold;
+  /** Kiss-of-Death "DENY" or "RSTR" received: not polled until set again */
+  bool  denied;
+#if SNTP_SUPPORT_DUAL_STACK
+  /** Address family which answered first the last time (SNTP_FAMILY_UNKNOWN: IPv6 is tried first) */
+  u8_t  family = SNTP_FAMILY_UNKNOWN;
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+#if SNTP_SUPPORT_INTERLEAVED
+  /** Receive timestamp of the last exchange (from the server, network byte order) */
+  u32_t xl_rx[2];
+  /** Transmit and receive time of the last exchange (local clock, in microseconds) */
+  s64_t xl_t1;
+  s64_t xl_t4;
+  /** _stepped_us when they were taken */
+  s64_t xl_stepped;
+  /** sys_now() when the last exchange was saved */
+  u32_t xl_time;
+  /** Basic responses to interleaved requests */
+  u8_t  xl_fails;
+  /** Whether the last exchange is saved */
+  bool  xl_valid;
+  /** Answered in interleaved mode: a basic exchange only prepares the follow-up, which syncs */
+  bool  xl_ok;
+#endif /* SNTP_SUPPORT_INTERLEAVED */
 };
-static struct sntp_server _servers[SNTP_MAX_SERVERS];
-
-#if SNTP_GET_SERVERS_FROM_DHCP
-static u8_t _set_servers_from_dhcp;
-#endif
-#if SNTP_SUPPORT_MULTIPLE_SERVERS
-/** The currently used server (initialized to 0) */
-static u8_t _current_server;
-#else /* SNTP_SUPPORT_MULTIPLE_SERVERS */
-#define _current_server 0
-#endif /* SNTP_SUPPORT_MULTIPLE_SERVERS */
-
-#if SNTP_RETRY_TIMEOUT_EXP
-#define SNTP_RESET_RETRY_TIMEOUT() _retry_timeout = SNTP_RETRY_TIMEOUT
-/** Retry time, initialized with SNTP_RETRY_TIMEOUT and doubled with each retry. */
-static u32_t _retry_timeout;
-#else /* SNTP_RETRY_TIMEOUT_EXP */
-#define SNTP_RESET_RETRY_TIMEOUT()
-#define _retry_timeout SNTP_RETRY_TIMEOUT
-#endif /* SNTP_RETRY_TIMEOUT_EXP */
 
+/**
+ * State of a client.
+ * The default instance is used by the functions without client argument and
+ * sets the system clock. Other instances only measure the offset of their servers.
+ */
+struct sntp_client {
+  /** The UDP pcb used by the client */
+  struct udp_pcb    *pcb;
+  struct sntp_server servers[SNTP_MAX_SERVERS];
+  /** The currently used server (initialized to 0) */
+  u8_t               current_server;
+  /** Retry time, initialized with SNTP_RETRY_TIMEOUT and doubled with each retry (if SNTP_RETRY_TIMEOUT_EXP). */
+  u32_t              retry_timeout;
 #if SNTP_CHECK_RESPONSE >= 1
-/** Saves the last server address to compare with response */
-static ip_addr_t _last_server_address;
+  /** Saves the last server address (of each address family) to compare with response */
+  ip_addr_t          last_server_address[SNTP_FAMILIES];
 #endif /* SNTP_CHECK_RESPONSE >= 1 */
-
 #if SNTP_CHECK_RESPONSE >= 2
-/** Saves the last timestamp sent (which is sent back by the server)
- * to compare against in response */
-static u32_t _last_timestamp_sent[2];
+  /** Saves the last timestamp sent (which is sent back by the server)
+   * to compare against in response */
+  u32_t              last_timestamp_sent[SNTP_FAMILIES][2];
 #endif /* SNTP_CHECK_RESPONSE >= 2 */
+#if SNTP_SUPPORT_DUAL_STACK
+  /** Addresses of the current server resolved for the race, by address family */
+  ip_addr_t          race_addr[SNTP_FAMILIES];
+  /** Bits of the address families being resolved, resolved but not sent yet, and sent */
+  u8_t               race_resolving;
+  u8_t               race_ready;
+  u8_t               race_sent;
+  /** Whether waiting SNTP_RACE_DELAY or SNTP_RESOLUTION_DELAY, and whether a wait has elapsed */
+  bool               race_wait;
+  bool               race_waived;
+  /** Whether servers given by name are raced over both address families (else only dns_gethostbyname() is used) */
+  bool               dual_stack = true;
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+#if SNTP_SUPPORT_INTERLEAVED
+  /** Whether requests are sent in interleaved mode (when possible) */
+  bool               interleaved;
+  /** Whether the last request was sent in interleaved mode */
+  bool               xl_sent;
+  /** Receive timestamp of the last interleaved request (sent back by the server in interleaved responses) */
+  u32_t              xl_sent_rx[2];
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+  u32_t              update_delay   = SNTP_UPDATE_DELAY;
+  /** Max random delay of the first request (in milliseconds) */
+  u32_t              startup_jitter = SNTP_STARTUP_JITTER;
+  /** Randomization of the update delay (in percent) */
+  u8_t               poll_jitter    = SNTP_POLL_JITTER_PERCENT;
+#if SNTP_SUPPORT_BROADCAST
+  /** SNTP_OPMODE_POLL or SNTP_OPMODE_LISTENONLY */
+  u8_t               opmode = SNTP_OPMODE_POLL;
+  /** One-way delay from the server in broadcast mode, calibrated by the first unicast exchange */
+  s64_t              broadcast_delay_us;
+#if LWIP_IGMP
+  /** Multicast group to join in broadcast mode */
+  ip_addr_t          multicast_group;
+#endif /* LWIP_IGMP */
+#endif /* SNTP_SUPPORT_BROADCAST */
+  /** sys_now() when the last request was started, and when the next one is scheduled */
+  u32_t              last_request_ms;
+  u32_t              next_request_ms;
+  /** Whether synced and waiting for the next request (not resolving, waiting for a response, nor retrying) */
+  bool               idle;
+  /** Whether this client only measures the offset (all but the default instance) */
+  bool               measure_only;
+  /** Whether this instance is taken from the pool */
+  bool               used;
+  /** Status of the last successful sync */
+  struct sntp_status status;
+  /** Counters of the exchanges since init() */
+  struct sntp_stats  stats;
+};
+
+#define SNTP_RESET_RETRY_TIMEOUT(client) (client)->retry_timeout = SNTP_RETRY_TIMEOUT
+
+/** The default instance, whose status is also used to answer in server mode */
+static struct sntp_client _default;
+
+/** Additional instances made by newclient() */
+static struct sntp_client _clients[SNTP_MAX_CLIENTS];
 
-static uint32 _update_delay = SNTP_UPDATE_DELAY;
+#if SNTP_GET_SERVERS_FROM_DHCP
+static u8_t _set_servers_from_dhcp;
+#endif
 
 static pftime::sync_callback_t _cb;
 static pftime::fail_callback_t _failcb;
 
+/** Listeners of sync events, with their context */
+struct sntp_listener {
+  pftime::event_callback_t cb;
+  void                    *ctx;
+};
+static struct sntp_listener _listeners[SNTP_MAX_LISTENERS];
+
+#if SNTP_EVENT_QUEUE_SIZE > 0
+/** Whether callbacks are deferred to dispatch() */
+static bool _deferred;
+
+/** Single-producer (lwIP thread) / single-consumer (application) ring of deferred events */
+static pftime::sync_event_t _events[SNTP_EVENT_QUEUE_SIZE];
+static volatile u8_t        _events_head; /* next slot to write, only written by producer */
+static volatile u8_t        _events_tail; /* next slot to read, only written by consumer */
+static u32_t                _events_dropped;
+#else /* SNTP_EVENT_QUEUE_SIZE > 0 */
+#define _deferred false
+#endif /* SNTP_EVENT_QUEUE_SIZE > 0 */
+
+#if SNTP_TRACE_SIZE > 0
+/** Ring of the latest state transitions, overwriting the oldest. Written by lwIP thread, and by the
+ * tasks calling init(), stop() or request() directly (e.g. configTzTime() from loop() on ESP32). */
+static pftime::trace_entry_t _trace[SNTP_TRACE_SIZE];
+static volatile u32_t        _trace_seq[SNTP_TRACE_SIZE]; /* number of the entry in the slot + 1 (0 while being written) */
+static volatile u32_t        _trace_head;                 /* number of entries ever claimed */
+
+/**
+ * Record a state transition of the client: a few stores, cheap enough to be always on.
+ */
+static inline void
+trace(const struct sntp_client *client, u8_t event, u16_t arg) {
+#ifdef ESP8266
+  /* lwIP and the sketch run in the same context */
+  u32_t head  = _trace_head;
+  _trace_head = head + 1;
+#else /* ESP8266 */
+  /* several tasks may write at once: each claims its own slot */
+  u32_t head = __atomic_fetch_add(&_trace_head, 1, __ATOMIC_RELAXED);
+#endif /* ESP8266 */
+  u32_t                  idx   = head & (SNTP_TRACE_SIZE - 1);
+  pftime::trace_entry_t *entry = &_trace[idx];
+  /* mark the slot torn first, so that gettrace() skips it until complete */
+  __atomic_store_n(&_trace_seq[idx], 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  entry->time_us = (u32_t)pftime_stamp::monotonic_us();
+  entry->event   = event;
+  entry->client  = client == &_default ? 0 : (u8_t)(client - _clients + 1);
+  entry->arg     = arg;
+  __atomic_store_n(&_trace_seq[idx], head + 1, __ATOMIC_RELEASE);
+}
+#else /* SNTP_TRACE_SIZE > 0 */
+#define trace(client, event, arg)
+#endif /* SNTP_TRACE_SIZE > 0 */
+
+/** Saturate a value to the argument of a trace entry, below TRACE_ARG_NONE */
+#define TRACE_ARG(v) ((u16_t)((v) < TRACE_ARG_NONE ? (v) : TRACE_ARG_NONE - 1))
+
+#ifdef ESP8266
+/** Number of syncs of the default instance, to wake up waitsync() */
+static volatile u32_t _syncs;
+#else /* ESP8266 */
+/** Semaphores of the tasks in waitsync(), guarded by _waiters_lock */
+static SemaphoreHandle_t _waiters[SNTP_MAX_WAITERS];
+static SemaphoreHandle_t _waiters_lock;
+static StaticSemaphore_t _waiters_lock_buf;
+/** Whether sync_now() is queued to lwIP thread */
+static bool              _sync_now_queued;
+#endif /* ESP8266 */
+
+#if SNTP_SUPPORT_INTERLEAVED
+/** Sum of the offsets applied to the system clock, to carry saved timestamps across steps */
+static s64_t _stepped_us;
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+
+#if SNTP_SUPPORT_SERVER
+/** The UDP pcb used by the server mode */
+static struct udp_pcb *_server_pcb;
+/** The port the server listens on (broadcasts are passed to the client when it's SNTP_PORT) */
+static u16_t           _server_port;
+#endif /* SNTP_SUPPORT_SERVER */
+
+/**
+ * Index of the address family (SNTP_FAMILY_IPV4 or SNTP_FAMILY_IPV6, always 0 without dual stack)
+ */
+static inline u8_t
+family_of(const ip_addr_t *addr) {
+#if SNTP_SUPPORT_DUAL_STACK
+  return IP_IS_V6(addr) ? SNTP_FAMILY_IPV6 : SNTP_FAMILY_IPV4;
+#else /* SNTP_SUPPORT_DUAL_STACK */
+  LWIP_UNUSED_ARG(addr);
+  return 0;
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+}
+
+static inline bool
+is_listenonly(const struct sntp_client *client) {
+#if SNTP_SUPPORT_BROADCAST
+  return client->opmode == SNTP_OPMODE_LISTENONLY;
+#else /* SNTP_SUPPORT_BROADCAST */
+  LWIP_UNUSED_ARG(client);
+  return false;
+#endif /* SNTP_SUPPORT_BROADCAST */
+}
+
 static void ICACHE_FLASH_ATTR
 set_system_time_us(const u32_t sec, const u32_t us, const u8_t li) {
+#ifdef SNTP_SET_SYSTEM_TIME_US
+  SNTP_SET_SYSTEM_TIME_US(sec, us, li);
+#else
   struct timeval tv = {(time_t)sec, (suseconds_t)us};
   pftime::settimeofday(&tv, nullptr, li);
+#endif
 }
 
 static void ICACHE_FLASH_ATTR
 get_system_time_us(u32_t *sec, u32_t *us) {
+#ifdef SNTP_GET_SYSTEM_TIME_US
+  SNTP_GET_SYSTEM_TIME_US(*sec, *us);
+#else
   struct timeval tv;
   ::gettimeofday(&tv, nullptr);
   *sec = (u32_t)tv.tv_sec;
   *us  = (u32_t)tv.tv_usec;
+#endif
 }
 
 /* convert SNTP time (1900-based) to unix GMT time (1970-based)
@@ -319,19 +694,287 @@ sntpsec_to_unixsec(const u32_t ntpsec) {
   return (sec & 0x80000000) == 0 ? sec + DIFF_SEC_1970_2036 : sec - DIFF_SEC_1900_1970;
 }
 
+/* convert SNTP timestamp (network byte order) to unix time in microseconds */
+static s64_t ICACHE_FLASH_ATTR
+sntp_to_usec(const u32_t *ts) {
+  return COMBINE_TO_USEC((s64_t)sntpsec_to_unixsec(ts[0]), (s64_t)(ntohl(ts[1]) / 4295));
+}
+
+/**
+ * Save the status of the server from a valid response
+ */
+static void ICACHE_FLASH_ATTR
+save_server_status(struct sntp_client *client, struct pbuf *p, const ip_addr_t *addr) {
+  struct sntp_msg hdr;
+  pbuf_copy_partial(p, &hdr, SNTP_OFFSET_REFERENCE_TIME, 0);
+  client->status.stratum         = hdr.stratum;
+  client->status.root_delay      = ntohl(hdr.root_delay);
+  client->status.root_dispersion = ntohl(hdr.root_dispersion);
+  ip_addr_set(&client->status.server, addr);
+}
+
+/**
+ * Save the result of syncing
+ */
+static void ICACHE_FLASH_ATTR
+save_sync_status(struct sntp_client *client, u8_t li, s64_t offset_us, s64_t rtt_us) {
+  client->status.synced    = true;
+  client->status.li        = li;
+  client->status.offset_us = offset_us;
+  client->status.rtt_us    = rtt_us;
+
+  u32_t now_sec, now_us;
+  get_system_time_us(&now_sec, &now_us);
+  client->status.sync_time.tv_sec  = (time_t)now_sec;
+  client->status.sync_time.tv_usec = (suseconds_t)now_us;
+
+  if (!client->measure_only) {
+    /* the next sync is expected within the (randomized) update delay */
+    u32_t next = client->update_delay;
+    if (next < client->servers[client->current_server].rate_hold)
+      next = client->servers[client->current_server].rate_hold;
+    pftime_hold::onsync(offset_us, rtt_us, next + next / 100 * client->poll_jitter);
+  }
+}
+
+/**
+ * Invoke the callback of the event.
+ */
+static void ICACHE_FLASH_ATTR
+invoke_callback(const pftime::sync_event_t *ev) {
+  if (ev->type == SYNC_EVENT_SUCCESS) {
+    if (_cb != nullptr)
+      _cb();
+  } else {
+    if (_failcb != nullptr)
+      _failcb(ev->message);
+  }
+
+  for (u8_t i = 0; i < SNTP_MAX_LISTENERS; i++) {
+    if (_listeners[i].cb != nullptr)
+      _listeners[i].cb(ev, _listeners[i].ctx);
+  }
+}
+
+/**
+ * Invoke the callback right now, or push the event to the queue if deferred.
+ */
+static void ICACHE_FLASH_ATTR
+notify(const pftime::sync_event_t *ev) {
+  if (!_deferred) {
+    invoke_callback(ev);
+    return;
+  }
+
+#if SNTP_EVENT_QUEUE_SIZE > 0
+  u8_t head = _events_head;
+  u8_t next = (u8_t)((head + 1) % SNTP_EVENT_QUEUE_SIZE);
+  if (next == __atomic_load_n(&_events_tail, __ATOMIC_ACQUIRE)) {
+    /* queue is full: drop the newest */
+    _events_dropped++;
+    return;
+  }
+  _events[head] = *ev;
+  __atomic_store_n(&_events_head, next, __ATOMIC_RELEASE);
+#endif /* SNTP_EVENT_QUEUE_SIZE > 0 */
+}
+
+/**
+ * Wake up the tasks in waitsync()
+ */
+static void ICACHE_FLASH_ATTR
+wake_waiters(void) {
+#ifdef ESP8266
+  _syncs++;
+  esp_schedule();
+#else /* ESP8266 */
+  if (_waiters_lock == nullptr)
+    return;
+  xSemaphoreTake(_waiters_lock, portMAX_DELAY);
+  for (u8_t i = 0; i < SNTP_MAX_WAITERS; i++) {
+    if (_waiters[i] != nullptr)
+      xSemaphoreGive(_waiters[i]);
+  }
+  xSemaphoreGive(_waiters_lock);
+#endif /* ESP8266 */
+}
+
+static void ICACHE_FLASH_ATTR
+notify_sync(struct sntp_client *client) {
+  if (client->measure_only)
+    return;
+
+  /* regardless of deferred callbacks */
+  wake_waiters();
+
+  pftime::sync_event_t ev;
+  ev.type           = SYNC_EVENT_SUCCESS;
+  ev.leap_indicator = client->status.li;
+  ev.stratum        = client->status.stratum;
+  ev.server_index   = client->current_server;
+#if SNTP_SERVER_DNS
+  ev.server         = client->servers[client->current_server].name;
+#else
+  ev.server         = nullptr;
+#endif
+  ev.offset_us      = client->status.offset_us;
+  ev.rtt_us         = client->status.rtt_us;
+  ev.message        = nullptr;
+  notify(&ev);
+}
+
+static void ICACHE_FLASH_ATTR
+notify_fail(struct sntp_client *client, const char *message) {
+  if (client->measure_only)
+    return;
+
+  pftime::sync_event_t ev;
+  ev.type           = SYNC_EVENT_FAIL;
+  ev.leap_indicator = LI_NO_WARNING;
+  ev.stratum        = 0;
+  ev.server_index   = client->current_server;
+#if SNTP_SERVER_DNS
+  ev.server         = client->servers[client->current_server].name;
+#else
+  ev.server         = nullptr;
+#endif
+  ev.offset_us      = 0;
+  ev.rtt_us         = 0;
+  ev.message        = message;
+  notify(&ev);
+}
+
+/**
+ * Record the raw timestamps of the exchange, if enabled
+ */
+static void ICACHE_FLASH_ATTR
+record_sample(struct sntp_client *client, s64_t t1, s64_t t2, s64_t t3, s64_t t4, u8_t li, u8_t mode, u8_t flags) {
+  if (!pftime_rec::enabled())
+    return;
+
+  pftime::sync_sample_t sample;
+  sample.t1_us   = t1;
+  sample.t2_us   = t2;
+  sample.t3_us   = t3;
+  sample.t4_us   = t4;
+  sample.mono_us = pftime_stamp::monotonic_us();
+#if LWIP_IPV6
+  if (IP_IS_V6(&client->status.server)) {
+    const u32_t *a = ip_2_ip6(&client->status.server)->addr;
+    sample.server  = a[0] ^ a[1] ^ a[2] ^ a[3];
+  } else
+#endif /* LWIP_IPV6 */
+  {
+    sample.server = ip4_addr_get_u32(ip_2_ip4(&client->status.server));
+  }
+  sample.li      = li;
+  sample.stratum = client->status.stratum;
+  sample.mode    = mode;
+  sample.flags   = flags | (client->measure_only ? SAMPLE_MEASURE_ONLY : 0);
+  pftime_rec::record(&sample);
+}
+
+/**
+ * Set the system clock, which was off by offset_us
+ */
+static void ICACHE_FLASH_ATTR
+step_system_time(s64_t true_now, s64_t offset_us, u8_t li) {
+  set_system_time_us(SEPARATE_USEC(true_now), li);
+#if SNTP_SUPPORT_INTERLEAVED
+  _stepped_us += offset_us;
+#else /* SNTP_SUPPORT_INTERLEAVED */
+  LWIP_UNUSED_ARG(offset_us);
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+}
+
+#if SNTP_SUPPORT_INTERLEAVED
+/**
+ * Save the exchange with the current server, to ask for its precise transmit timestamp in the next request
+ */
+static void ICACHE_FLASH_ATTR
+save_exchange(struct sntp_client *client, s64_t t1, const u32_t *receive_timestamp, s64_t t4) {
+  struct sntp_server *server = &client->servers[client->current_server];
+  server->xl_rx[0]   = receive_timestamp[0];
+  server->xl_rx[1]   = receive_timestamp[1];
+  server->xl_t1      = t1;
+  server->xl_t4      = t4;
+  server->xl_stepped = _stepped_us;
+  server->xl_time    = sys_now();
+  server->xl_valid   = true;
+}
+
+/**
+ * SNTP processing of an interleaved response, which carries the precise transmit timestamp
+ * of the response to the previous request (draft-ietf-ntp-interleaved-modes, client/server mode)
+ */
+static void ICACHE_FLASH_ATTR
+process_interleaved(struct sntp_client *client, u32_t *receive_timestamp, u32_t *transmit_timestamp, u8_t li) {
+  struct sntp_server *server = &client->servers[client->current_server];
+
+  /* the previous exchange, in the current timescale of the system clock */
+  s64_t stepped = _stepped_us - server->xl_stepped;
+  s64_t t1      = server->xl_t1 + stepped;
+  s64_t t2      = sntp_to_usec(server->xl_rx);
+  s64_t t3      = sntp_to_usec(transmit_timestamp);
+  s64_t t4      = server->xl_t4 + stepped;
+
+  u32_t now_sec, now_us;
+  get_system_time_us(&now_sec, &now_us);
+  s64_t now = COMBINE_TO_USEC((s64_t)now_sec, (s64_t)now_us);
+  record_sample(client, t1, t2, t3, t4, li, SNTP_MODE_SERVER, SAMPLE_INTERLEAVED);
+
+  /* this exchange is the previous one of the next interleaved response
+   * (no need to convert for the transmit timestamp sent, see initialize_request) */
+  const u32_t *sent = client->last_timestamp_sent[family_of(&client->status.server)];
+  save_exchange(client, COMBINE_TO_USEC((s64_t)sent[0], (s64_t)sent[1]), receive_timestamp, now);
+
+  /* the clock has drifted little since the previous exchange (SNTP_INTERLEAVED_MAX_AGE) */
+  s64_t toffset  = ((t2 + t3) - (t1 + t4)) >> 1;
+  s64_t true_now = now + toffset;
+  s64_t rtt      = (t4 - t1) - (t3 - t2);
+  if (!client->measure_only)
+    step_system_time(true_now, toffset, li);
+  save_sync_status(client, li, toffset, rtt);
+  log_d("time = %d.%06d, LI = %s (interleaved)", SEPARATE_USEC(true_now), LI_ntoa(li));
+  log_d("RTT  = %" S64_F " us, ", rtt);
+  notify_sync(client);
+}
+
+/**
+ * Save a basic exchange for the interleaved follow-up, without syncing to it
+ */
+static void ICACHE_FLASH_ATTR
+prepare_interleaved(struct sntp_client *client, u32_t *originate_timestamp, u32_t *receive_timestamp) {
+  u32_t now_sec, now_us;
+  get_system_time_us(&now_sec, &now_us);
+  /* no need to convert for originate timestamp (see initialize_request) */
+  save_exchange(client, COMBINE_TO_USEC((s64_t)originate_timestamp[0], (s64_t)originate_timestamp[1]),
+    receive_timestamp, COMBINE_TO_USEC((s64_t)now_sec, (s64_t)now_us));
+  log_d("Basic response saved for the interleaved follow-up");
+}
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+
 /**
  * SNTP processing of received timestamp
  */
 static void ICACHE_FLASH_ATTR
-process(u32_t *originate_timestamp, u32_t *receive_timestamp, u32_t *transmit_timestamp, u8_t li) {
+process(struct sntp_client *client, u32_t *originate_timestamp, u32_t *receive_timestamp, u32_t *transmit_timestamp, u8_t li) {
   if (originate_timestamp == nullptr || receive_timestamp == nullptr) {
-    u32_t sec = sntpsec_to_unixsec(transmit_timestamp[0]);
-    u32_t us  = ntohl(transmit_timestamp[1]) / 4295;
-    set_system_time_us(sec, us, li);
-    log_d("time = %d.%06d, LI = %s", sec, us, LI_ntoa(li));
-    if (_cb != nullptr) {
-    	_cb();
-    }
+    /* broadcast: compensate for the calibrated propagation delay */
+    s64_t raw_tx = sntp_to_usec(transmit_timestamp);
+    s64_t tx     = raw_tx;
+#if SNTP_SUPPORT_BROADCAST
+    tx += client->broadcast_delay_us;
+#endif /* SNTP_SUPPORT_BROADCAST */
+    u32_t now_sec, now_us;
+    get_system_time_us(&now_sec, &now_us);
+    s64_t now = COMBINE_TO_USEC((s64_t)now_sec, (s64_t)now_us);
+    record_sample(client, 0, 0, raw_tx, now, li, SNTP_MODE_BROADCAST, 0);
+    if (!client->measure_only)
+      step_system_time(tx, tx - now, li);
+    save_sync_status(client, li, tx - now, 0);
+    log_d("time = %d.%06d, LI = %s", SEPARATE_USEC(tx), LI_ntoa(li));
+    notify_sync(client);
     return;
   }
 
@@ -340,34 +983,35 @@ process(u32_t *originate_timestamp, u32_t *receive_timestamp, u32_t *transmit_ti
   s64_t orig_us  = (s64_t)originate_timestamp[1];
   s64_t orig     = COMBINE_TO_USEC(orig_sec, orig_us);
 
-  s64_t tx_sec   = (s64_t)sntpsec_to_unixsec(transmit_timestamp[0]);
-  s64_t tx_us    = (s64_t)(ntohl(transmit_timestamp[1]) / 4295);
-  s64_t tx       = COMBINE_TO_USEC(tx_sec, tx_us);
-  
-  s64_t rx_sec   = (s64_t)sntpsec_to_unixsec(receive_timestamp[0]);
-  s64_t rx_us    = (s64_t)(ntohl(receive_timestamp[1]) / 4295);
-  s64_t rx       = COMBINE_TO_USEC(rx_sec, rx_us);
-  
+  s64_t tx       = sntp_to_usec(transmit_timestamp);
+  s64_t rx       = sntp_to_usec(receive_timestamp);
+
   u32_t now_sec, now_us;
   get_system_time_us(&now_sec, &now_us);
   s64_t now = COMBINE_TO_USEC((s64_t)now_sec, (s64_t)now_us);
+  record_sample(client, orig, rx, tx, now, li, SNTP_MODE_SERVER, 0);
+#if SNTP_SUPPORT_INTERLEAVED
+  if (client->interleaved)
+    save_exchange(client, orig, receive_timestamp, now);
+#endif /* SNTP_SUPPORT_INTERLEAVED */
 
   s64_t toffset  = ((rx + tx) - (orig + now)) >> 1; /* x / 2 == x >> 1 */
   s64_t true_now = now + toffset;
-  set_system_time_us(SEPARATE_USEC(true_now), li);
+  s64_t rtt      = (now - orig) - (tx - rx);
+  if (!client->measure_only)
+    step_system_time(true_now, toffset, li);
+  save_sync_status(client, li, toffset, rtt);
   /* display local time from GMT time */
   log_d("time = %d.%06d, LI = %s", SEPARATE_USEC(true_now), LI_ntoa(li));
-  log_d("RTT  = %" S64_F " us, ", (now - orig) - (tx - rx));
-  if (_cb != nullptr) {
-  	_cb();
-  }
+  log_d("RTT  = %" S64_F " us, ", rtt);
+  notify_sync(client);
 }
 
 /**
  * Initialize request struct to be sent to server.
  */
 static void ICACHE_FLASH_ATTR
-initialize_request(struct sntp_msg *req) {
+initialize_request(struct sntp_client *client, struct sntp_msg *req, u8_t family) {
   os_memset(req, 0, SNTP_MSG_LEN);
   req->li_vn_mode = LI_NO_WARNING | SNTP_VERSION | SNTP_MODE_CLIENT;
 
@@ -379,41 +1023,170 @@ initialize_request(struct sntp_msg *req) {
   req->transmit_timestamp[1] = sntp_time_us;
 
 #if SNTP_CHECK_RESPONSE >= 2
-  /* save transmit timestamp in '_last_timestamp_sent' */
-  _last_timestamp_sent[0] = req->transmit_timestamp[0];
-  _last_timestamp_sent[1] = req->transmit_timestamp[1];
+  /* save transmit timestamp in 'last_timestamp_sent' */
+  client->last_timestamp_sent[family][0] = req->transmit_timestamp[0];
+  client->last_timestamp_sent[family][1] = req->transmit_timestamp[1];
+#else /* SNTP_CHECK_RESPONSE >= 2 */
+  LWIP_UNUSED_ARG(client);
+  LWIP_UNUSED_ARG(family);
 #endif /* SNTP_CHECK_RESPONSE >= 2 */
+
+#if SNTP_SUPPORT_INTERLEAVED
+  struct sntp_server *server = &client->servers[client->current_server];
+  client->xl_sent = client->interleaved && server->xl_valid &&
+                    server->xl_fails < SNTP_INTERLEAVED_MAX_FAILS &&
+                    (u32_t)(sys_now() - server->xl_time) < SNTP_INTERLEAVED_MAX_AGE;
+  if (client->xl_sent) {
+    /* interleaved request: the server's receive timestamp of the previous request as originate,
+     * and our receive time of its response, which an interleaved response carries back as originate */
+    req->originate_timestamp[0] = server->xl_rx[0];
+    req->originate_timestamp[1] = server->xl_rx[1];
+    req->receive_timestamp[0]   = (u32_t)(server->xl_t4 / USECS_IN_SEC);
+    req->receive_timestamp[1]   = (u32_t)(server->xl_t4 % USECS_IN_SEC);
+    client->xl_sent_rx[0]       = req->receive_timestamp[0];
+    client->xl_sent_rx[1]       = req->receive_timestamp[1];
+  }
+#endif /* SNTP_SUPPORT_INTERLEAVED */
 }
 
 /**
  * Retry: send a new request (and increase retry timeout).
  *
- * @param arg is unused (only necessary to conform to sys_timeout)
+ * @param arg the client
  */
 static void ICACHE_FLASH_ATTR
 retry(void *arg) {
-  LWIP_UNUSED_ARG(arg);
+  struct sntp_client *client = (struct sntp_client *)arg;
 
   log_v("Next request will be sent in %" U32_F " ms",
-    _retry_timeout);
+    client->retry_timeout);
+  trace(client, TRACE_RETRY, TRACE_ARG(client->retry_timeout));
 
   /* set up a timer to send a retry and increase the retry delay */
-  sys_timeout(_retry_timeout, request, nullptr);
+  sys_timeout(client->retry_timeout, request, client);
 
 #if SNTP_RETRY_TIMEOUT_EXP
   {
     u32_t new_retry_timeout;
     /* increase the timeout for next retry */
-    new_retry_timeout = _retry_timeout << 1;
+    new_retry_timeout = client->retry_timeout << 1;
     /* limit to maximum timeout and prevent overflow */
     if ((new_retry_timeout <= SNTP_RETRY_TIMEOUT_MAX) &&
-        (new_retry_timeout > _retry_timeout)) {
-      _retry_timeout = new_retry_timeout;
+        (new_retry_timeout > client->retry_timeout)) {
+      client->retry_timeout = new_retry_timeout;
     }
   }
 #endif /* SNTP_RETRY_TIMEOUT_EXP */
 }
 
+/**
+ * Whether the server is configured by address or name
+ */
+static bool ICACHE_FLASH_ATTR
+is_server_configured(const struct sntp_client *client, u8_t idx) {
+  return !ip_addr_isany(&client->servers[idx].addr)
+#if SNTP_SERVER_DNS
+         || (client->servers[idx].name != nullptr)
+#endif
+         ;
+}
+
+#if SNTP_SUPPORT_MULTIPLE_SERVERS
+/**
+ * Whether the server is configured and has not denied access
+ */
+static bool ICACHE_FLASH_ATTR
+is_server_usable(const struct sntp_client *client, u8_t idx) {
+  return is_server_configured(client, idx) && !client->servers[idx].denied;
+}
+#endif /* SNTP_SUPPORT_MULTIPLE_SERVERS */
+
+/**
+ * Remaining time (in milliseconds) not to poll the server after "RATE", or 0
+ */
+static u32_t ICACHE_FLASH_ATTR
+server_hold(struct sntp_client *client, u8_t idx) {
+  struct sntp_server *server = &client->servers[idx];
+  if (server->hold_until == 0)
+    return 0;
+  s32_t remaining = (s32_t)(server->hold_until - sys_now());
+  if (remaining <= 0) {
+    server->hold_until = 0;
+    return 0;
+  }
+  return (u32_t)remaining;
+}
+
+/**
+ * Forget Kiss-of-Death received from the server, and the previous exchange with it
+ */
+static void ICACHE_FLASH_ATTR
+reset_server(struct sntp_server *server) {
+  server->hold_until = 0;
+  server->rate_hold  = 0;
+  server->denied     = false;
+#if SNTP_SUPPORT_INTERLEAVED
+  server->xl_fails   = 0;
+  server->xl_valid   = false;
+  server->xl_ok      = false;
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+}
+
+#if SNTP_CHECK_RESPONSE >= 2
+/**
+ * Apply the kiss code of Kiss-of-Death to the current server (RFC 5905, 7.4),
+ * once its originate timestamp proved it answers our request
+ *
+ * @return description of the kiss code
+ */
+static const char * ICACHE_FLASH_ATTR
+apply_kiss(struct sntp_client *client, const u8_t *code) {
+  struct sntp_server *server = &client->servers[client->current_server];
+
+  if (memcmp(code, "RATE", 4) == 0) {
+    /* slow down: hold the server, twice as long as the last time */
+    u32_t hold = server->rate_hold == 0 ? (u32_t)SNTP_KOD_RATE_HOLD : server->rate_hold << 1;
+    if (hold > SNTP_KOD_RATE_HOLD_MAX || hold < server->rate_hold)
+      hold = SNTP_KOD_RATE_HOLD_MAX;
+    server->rate_hold  = hold;
+    server->hold_until = sys_now() + hold;
+    if (server->hold_until == 0)
+      server->hold_until = 1;
+    log_w("Kiss-of-Death RATE: server %" U16_F " on hold for %" U32_F " ms",
+      (u16_t)client->current_server, hold);
+    return "Kiss of death: RATE";
+  }
+  if (memcmp(code, "DENY", 4) == 0 || memcmp(code, "RSTR", 4) == 0) {
+    /* access denied: stop polling the server */
+    server->denied = true;
+    log_w("Kiss-of-Death %.4s: server %" U16_F " no longer used",
+      (const char *)code, (u16_t)client->current_server);
+    return code[1] == 'E' ? "Kiss of death: DENY" : "Kiss of death: RSTR";
+  }
+  log_v("Kiss-of-Death %.4s", (const char *)code);
+  return "Kiss of death";
+}
+#endif /* SNTP_CHECK_RESPONSE >= 2 */
+
+/**
+ * Update delay of the current server, randomized by poll_jitter percent
+ */
+static u32_t ICACHE_FLASH_ATTR
+next_update_delay(struct sntp_client *client) {
+  u32_t delay  = client->update_delay;
+  u32_t hold   = client->servers[client->current_server].rate_hold;
+  if (delay < hold)
+    delay = hold;
+
+  u32_t spread = delay / 100 * client->poll_jitter;
+  if (spread > 0) {
+    delay = delay - spread + LWIP_RAND() % (2 * spread + 1);
+    if (delay < SNTP_UPDATE_DELAY_MIN)
+      delay = SNTP_UPDATE_DELAY_MIN;
+  }
+  return delay;
+}
+
 #if SNTP_SUPPORT_MULTIPLE_SERVERS
 /**
  * If Kiss-of-Death is received (or another packet parsing error),
@@ -421,43 +1194,59 @@ retry(void *arg) {
  * timeout if only one server is available.
  * (implicitly, SNTP_MAX_SERVERS > 1)
  *
- * @param arg is unused (only necessary to conform to sys_timeout)
+ * @param arg the client
  */
 static void ICACHE_FLASH_ATTR
 try_next_server(void *arg) {
-  u8_t old_server, i;
-  LWIP_UNUSED_ARG(arg);
-
-  old_server = _current_server;
-  for (i = 0; i < SNTP_MAX_SERVERS - 1; i++) {
-    _current_server++;
-    if (_current_server >= SNTP_MAX_SERVERS) {
-      _current_server = 0;
+  struct sntp_client *client = (struct sntp_client *)arg;
+  u8_t old_server, next_server, idx, i;
+
+#if SNTP_SUPPORT_DUAL_STACK
+  race_end(client);
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+
+  old_server  = client->current_server;
+  next_server = SNTP_MAX_SERVERS;
+  for (i = 1; i < SNTP_MAX_SERVERS; i++) {
+    idx = (u8_t)((old_server + i) % SNTP_MAX_SERVERS);
+    if (!is_server_usable(client, idx)) {
+      continue;
     }
-    if (!ip_addr_isany(&_servers[_current_server].addr)
-#if SNTP_SERVER_DNS
-        || (_servers[_current_server].name != nullptr)
-#endif
-        ) {
-      log_v("Sending request to server %" U16_F,
-        (u16_t)_current_server);
-      /* new server: reset retry timeout */
-      SNTP_RESET_RETRY_TIMEOUT();
-      /* instantly send a request to the next server */
-      request(nullptr);
-      return;
+    /* prefer a server not on hold after "RATE" */
+    if (next_server == SNTP_MAX_SERVERS) {
+      next_server = idx;
+    }
+    if (server_hold(client, idx) == 0) {
+      next_server = idx;
+      break;
     }
   }
+  if (next_server < SNTP_MAX_SERVERS) {
+    client->current_server = next_server;
+    log_v("Sending request to server %" U16_F,
+      (u16_t)client->current_server);
+    trace(client, TRACE_NEXT_SERVER, next_server);
+    /* new server: reset retry timeout */
+    SNTP_RESET_RETRY_TIMEOUT(client);
+    /* instantly send a request to the next server (or wait for the hold) */
+    request(client);
+    return;
+  }
   /* no other valid server found */
-  _current_server = old_server;
-  retry(nullptr);
+  if (client->servers[old_server].denied) {
+    log_e("All servers denied access");
+    notify_fail(client, "All servers denied access");
+    return;
+  }
+  retry(client);
 }
 #else /* SNTP_SUPPORT_MULTIPLE_SERVERS */
 /* Always retry on error if only one server is supported */
 #define try_next_server    retry
 #endif /* SNTP_SUPPORT_MULTIPLE_SERVERS */
 
-err_t recv_check(struct pbuf *p, const ip_addr_t *addr, const u16_t port,
+err_t recv_check(struct sntp_client *client,
+                 struct pbuf *p, const ip_addr_t *addr, const u16_t port,
                  u8_t  *li,
                  u8_t  *mode,
                  u32_t *originate_timestamp,
@@ -467,12 +1256,11 @@ err_t recv_check(struct pbuf *p, const ip_addr_t *addr, const u16_t port,
   u8_t stratum;
 
 #if SNTP_CHECK_RESPONSE >= 1
-  /* check server address and port */
-  if (!(ip_addr_cmp(addr, &_last_server_address)) || (port != SNTP_PORT)) {
+  /* check server address and port (broadcasts may come from any server) */
+  if (!is_listenonly(client) &&
+      (!(ip_addr_cmp(addr, &client->last_server_address[family_of(addr)])) || (port != SNTP_PORT))) {
     log_w("Invalid server address or port");
-	if (_failcb != nullptr) {
-		_failcb("Invalid server address or port");
-	}
+    notify_fail(client, "Invalid server address or port");
     return ERR_ARG;
   }
 #else  /* SNTP_CHECK_RESPONSE < 1 */
@@ -483,106 +1271,197 @@ err_t recv_check(struct pbuf *p, const ip_addr_t *addr, const u16_t port,
   /* process the response */
   if (p->tot_len < SNTP_MSG_LEN) {
     log_w("Invalid packet length: %" U16_F, p->tot_len);
-	if (_failcb != nullptr) {
-		_failcb("Invalid packet length");
-	}
+    notify_fail(client, "Invalid packet length");
+    return ERR_ARG;
+  }
+
+  /* parse in place if the header is contiguous (usual case), otherwise gather it once */
+  u8_t        buf[SNTP_MSG_LEN];
+  const u8_t *hdr;
+  if (p->len >= SNTP_MSG_LEN) {
+    hdr = (const u8_t *)p->payload;
+  } else if (pbuf_copy_partial(p, buf, SNTP_MSG_LEN, 0) == SNTP_MSG_LEN) {
+    hdr = buf;
+  } else {
+    log_w("Truncated packet");
+    notify_fail(client, "Invalid packet length");
     return ERR_ARG;
   }
-  
-  pbuf_copy_partial(p, mode, 1, SNTP_OFFSET_LI_VN_MODE);
-  *li = (*mode & SNTP_LI_MASK) >> 6;
-  *mode &= SNTP_MODE_MASK;
+
+  *li   = (hdr[SNTP_OFFSET_LI_VN_MODE] & SNTP_LI_MASK) >> 6;
+  *mode = hdr[SNTP_OFFSET_LI_VN_MODE] & SNTP_MODE_MASK;
   /* check SNTP mode */
   if ((*mode != SNTP_MODE_SERVER) &&
       (*mode != SNTP_MODE_BROADCAST)) {
     log_w("Invalid mode in response: %" U16_F, (u16_t)*mode);
-	if (_failcb != nullptr) {
-		_failcb("Invalid mode in response");
-	}
+    notify_fail(client, "Invalid mode in response");
     return ERR_ARG;
   }
 
-  /* check stratum and LI */
-  pbuf_copy_partial(p, &stratum, 1, SNTP_OFFSET_STRATUM);
+  if (*mode == SNTP_MODE_SERVER) {
+    memcpy(originate_timestamp, hdr + SNTP_OFFSET_ORIGINATE_TIME, 8);
+#if SNTP_CHECK_RESPONSE >= 2
+    /* check originate_timetamp against last_timestamp_sent (or the receive timestamp of an interleaved request) */
+    const u32_t *sent = client->last_timestamp_sent[family_of(addr)];
+    if (((originate_timestamp[0] != sent[0]) ||
+         (originate_timestamp[1] != sent[1]))
+#if SNTP_SUPPORT_INTERLEAVED
+        && !(client->xl_sent &&
+             (originate_timestamp[0] == client->xl_sent_rx[0]) &&
+             (originate_timestamp[1] == client->xl_sent_rx[1]))
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+        ) {
+      log_w("Invalid originate timestamp in response");
+      notify_fail(client, "Invalid originate timestamp in response");
+      return ERR_ARG;
+    }
+#endif /* SNTP_CHECK_RESPONSE >= 2 */
+    /* @todo: add code for SNTP_CHECK_RESPONSE >= 3 and >= 4 here */
+  }
+
+  /* check stratum and LI (only now: a Kiss-of-Death must answer our request, RFC 5905 7.4) */
+  stratum = hdr[SNTP_OFFSET_STRATUM];
   if (stratum == SNTP_STRATUM_KOD) {
     /* Kiss-of-death packet. Use another server or increase UPDATE_DELAY. */
     log_v("Received Kiss-of-Death");
-	if (_failcb != nullptr) {
-		_failcb("Kiss of death");
-	}
+#if SNTP_CHECK_RESPONSE >= 2
+    notify_fail(client, *mode == SNTP_MODE_SERVER ? apply_kiss(client, hdr + SNTP_OFFSET_REFERENCE_ID) : "Kiss of death");
+#else /* SNTP_CHECK_RESPONSE >= 2 */
+    /* without the originate check, anyone could have sent it: don't obey it */
+    notify_fail(client, "Kiss of death");
+#endif /* SNTP_CHECK_RESPONSE >= 2 */
     return SNTP_ERR_KOD;
   }
   if (*li == LI_ALARM_CONDITION) {
     /* LI indicates alarm condition. Use another server or increase UPDATE_DELAY. */
     log_v("Received LI_ALARM_CONDITION");
-	if (_failcb != nullptr) {
-		_failcb("Received LI_ALARM_CONDITION");
-	}
+    notify_fail(client, "Received LI_ALARM_CONDITION");
     return SNTP_ERR_KOD;
   }
 
   if (*mode == SNTP_MODE_SERVER) {
-    pbuf_copy_partial(p, originate_timestamp, 8, SNTP_OFFSET_ORIGINATE_TIME);
-#if SNTP_CHECK_RESPONSE >= 2
-    /* check originate_timetamp against _last_timestamp_sent */
-    if ((originate_timestamp[0] != _last_timestamp_sent[0]) ||
-        (originate_timestamp[1] != _last_timestamp_sent[1])) {
-      log_w("Invalid originate timestamp in response");
-	if (_failcb != nullptr) {
-		_failcb("Invalid originate timestamp in response");
-	}
-      return ERR_ARG;
-    }
-#endif /* SNTP_CHECK_RESPONSE >= 2 */
-    /* @todo: add code for SNTP_CHECK_RESPONSE >= 3 and >= 4 here */
-
     /* correct answer */
-    pbuf_copy_partial(p, receive_timestamp, SNTP_RECEIVE_TIME_SIZE * 4, SNTP_OFFSET_RECEIVE_TIME);
+    memcpy(receive_timestamp, hdr + SNTP_OFFSET_RECEIVE_TIME, SNTP_RECEIVE_TIME_SIZE * 4);
   }
-  pbuf_copy_partial(p, transmit_timestamp, SNTP_RECEIVE_TIME_SIZE * 4, SNTP_OFFSET_TRANSMIT_TIME);
+  memcpy(transmit_timestamp, hdr + SNTP_OFFSET_TRANSMIT_TIME, SNTP_RECEIVE_TIME_SIZE * 4);
   return ERR_OK;
 }
 
 /** UDP recv callback for the sntp pcb */
 static void ICACHE_FLASH_ATTR
 recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  struct sntp_client *client = (struct sntp_client *)arg;
   u8_t  li, mode;
   u32_t originate_timestamp[2];
   u32_t receive_timestamp  [SNTP_RECEIVE_TIME_SIZE];
   u32_t transmit_timestamp [SNTP_RECEIVE_TIME_SIZE];
 //os_printf("recv\n");
-  LWIP_UNUSED_ARG(arg);
   LWIP_UNUSED_ARG(pcb);
 
-  /* packet received: stop retry timeout  */
-  sys_untimeout(try_next_server, nullptr);
-  sys_untimeout(request, nullptr);
+#if SNTP_SUPPORT_DUAL_STACK
+  if (!is_listenonly(client) && (client->race_sent & (1 << family_of(addr))) == 0) {
+    /* no request in flight over the family, e.g. it lost the race: ignore */
+    trace(client, TRACE_RECV, 3);
+    pbuf_free(p);
+    return;
+  }
+#endif /* SNTP_SUPPORT_DUAL_STACK */
 
-  err_t err = recv_check(p, addr, port, &li, &mode, originate_timestamp, receive_timestamp, transmit_timestamp);
+  err_t err = recv_check(client, p, addr, port, &li, &mode, originate_timestamp, receive_timestamp, transmit_timestamp);
+  if (err == ERR_OK) {
+    save_server_status(client, p, addr);
+    client->stats.accepted++;
+  } else if (err == SNTP_ERR_KOD) {
+    client->stats.kod++;
+  } else {
+    client->stats.rejected++;
+  }
+  trace(client, TRACE_RECV, err == ERR_OK ? 0 : err == SNTP_ERR_KOD ? 1 : 2);
   pbuf_free(p);
+
+  if (is_listenonly(client) && !(err == ERR_OK && mode == SNTP_MODE_SERVER)) {
+    /* broadcast mode: ignore invalid packets, and leave the calibration in progress alone */
+    if (err == ERR_OK)
+      process(client, nullptr, nullptr, transmit_timestamp, li);
+    return;
+  }
+
+  /* packet received: stop retry timeout  */
+  sys_untimeout(try_next_server, client);
+  sys_untimeout(request, client);
+#if SNTP_SUPPORT_DUAL_STACK
+  race_end(client);
+  if (err == ERR_OK && client->servers[client->current_server].name) {
+    /* remember the winner, to try it first next time */
+    client->servers[client->current_server].family = family_of(addr);
+    ip_addr_set(&client->servers[client->current_server].addr, addr);
+  }
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+
   if (err == ERR_OK) {
     /* Correct response, reset retry timeout */
-    SNTP_RESET_RETRY_TIMEOUT();
-
+    SNTP_RESET_RETRY_TIMEOUT(client);
+
+#if SNTP_SUPPORT_INTERLEAVED
+    struct sntp_server *server      = &client->servers[client->current_server];
+    bool                interleaved = false;
+    if (mode == SNTP_MODE_SERVER && client->xl_sent) {
+      interleaved = originate_timestamp[0] == client->xl_sent_rx[0] &&
+                    originate_timestamp[1] == client->xl_sent_rx[1];
+      if (interleaved) {
+        server->xl_fails = 0;
+        server->xl_ok    = true;
+      } else if (++server->xl_fails == SNTP_INTERLEAVED_MAX_FAILS) {
+        /* basic response to interleaved requests: no support (or no state kept) in the server */
+        log_d("Server %" U16_F " doesn't support interleaved mode",
+          (u16_t)client->current_server);
+        server->xl_ok = false;
+      }
+    }
+    /* follow up soon, to get the precise transmit timestamp of a basic response,
+     * unless the server asked for a longer interval with RATE */
+    bool follow_up = client->interleaved && !interleaved && mode == SNTP_MODE_SERVER &&
+                     server->xl_fails < SNTP_INTERLEAVED_MAX_FAILS &&
+                     server->rate_hold <= SNTP_INTERLEAVED_DELAY;
+    if (interleaved)
+      process_interleaved(client, receive_timestamp, transmit_timestamp, li);
+    else if (follow_up && server->xl_ok && !client->xl_sent)
+      /* the first exchange of a poll of a server known to answer the follow-up:
+       * sync once to the precise follow-up, rather than twice in a row */
+      prepare_interleaved(client, originate_timestamp, receive_timestamp);
+    else
+#endif /* SNTP_SUPPORT_INTERLEAVED */
     if (mode == SNTP_MODE_SERVER)
-      process(originate_timestamp, receive_timestamp, transmit_timestamp, li);
+      process(client, originate_timestamp, receive_timestamp, transmit_timestamp, li);
     else
-      process(nullptr,             nullptr,           transmit_timestamp, li);
+      process(client, nullptr,             nullptr,           transmit_timestamp, li);
+
+#if SNTP_SUPPORT_BROADCAST
+    if (is_listenonly(client)) {
+      /* calibrated: sync only from broadcasts from now on */
+      client->broadcast_delay_us = client->status.rtt_us / 2;
+      log_d("Broadcast delay calibrated: %" S64_F " us", client->broadcast_delay_us);
+      return;
+    }
+#endif /* SNTP_SUPPORT_BROADCAST */
 
     /* Set up timeout for next request */
-    sys_timeout((u32_t)_update_delay, request, nullptr);
-    log_v("Scheduled next time request: %" U32_F " ms",
-      (u32_t)_update_delay);
+    u32_t delay = next_update_delay(client);
+#if SNTP_SUPPORT_INTERLEAVED
+    if (follow_up)
+      delay = SNTP_INTERLEAVED_DELAY;
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+    sys_timeout(delay, request, client);
+    client->next_request_ms = sys_now() + delay;
+    client->idle            = true;
+    trace(client, TRACE_SCHEDULE, TRACE_ARG(delay / 1000));
+    log_v("Scheduled next time request: %" U32_F " ms", delay);
   } else if (err == SNTP_ERR_KOD) {
-    /* Kiss-of-death packet. Use another server or increase UPDATE_DELAY. */
-	if (_failcb != nullptr) {
-		_failcb("Kiss of death");
-	}
-
-    try_next_server(nullptr);
+    /* Kiss-of-death packet (already notified). Use another server or wait for the hold. */
+    try_next_server(client);
   } else {
     /* another error, try the same server again */
-    retry(nullptr);
+    retry(client);
   }
 }
 
@@ -591,7 +1470,7 @@ recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_
  * @param server_addr resolved IP address of the SNTP server
  */
 static void ICACHE_FLASH_ATTR
-send_request(const ip_addr_t *server_addr) {
+send_request(struct sntp_client *client, const ip_addr_t *server_addr) {
   struct pbuf *p;
 //  os_printf("send_request\n");
   p = pbuf_alloc(PBUF_TRANSPORT, SNTP_MSG_LEN, PBUF_RAM);
@@ -599,22 +1478,30 @@ send_request(const ip_addr_t *server_addr) {
     struct sntp_msg *sntpmsg = (struct sntp_msg *)p->payload;
     log_v("Sending request to server");
     /* initialize request message */
-    initialize_request(sntpmsg);
+    initialize_request(client, sntpmsg, family_of(server_addr));
     /* send request */
-    udp_sendto(_sntp_pcb, p, server_addr, SNTP_PORT);
+    udp_sendto(client->pcb, p, server_addr, SNTP_PORT);
+    client->stats.requests++;
+    trace(client, TRACE_SEND, family_of(server_addr));
     /* free the pbuf after sending it */
     pbuf_free(p);
-    /* set up receive timeout: try next server or retry on timeout */
-    sys_timeout((u32_t)SNTP_RECV_TIMEOUT, try_next_server, nullptr);
+    /* set up receive timeout: try next server or retry on timeout
+     * (restarted if a request is in flight over the other address family) */
+    sys_untimeout(try_next_server, client);
+    sys_timeout((u32_t)SNTP_RECV_TIMEOUT, try_next_server, client);
 #if SNTP_CHECK_RESPONSE >= 1
-    /* save server address to verify it in recv() */ 
-    ip_addr_set(&_last_server_address, server_addr);
+    /* save server address to verify it in recv() */
+    ip_addr_set(&client->last_server_address[family_of(server_addr)], server_addr);
 #endif /* SNTP_CHECK_RESPONSE >= 1 */
+#if SNTP_SUPPORT_DUAL_STACK
+    client->race_sent |= (u8_t)(1 << family_of(server_addr));
+#endif /* SNTP_SUPPORT_DUAL_STACK */
   } else {
     log_n("Out of memory, trying again in %" U32_F " ms",
       (u32_t)SNTP_RETRY_TIMEOUT);
     /* out of memory: set up a timer to send a retry */
-    sys_timeout((u32_t)SNTP_RETRY_TIMEOUT, request, nullptr);
+    trace(client, TRACE_SEND, TRACE_ARG_NONE);
+    sys_timeout((u32_t)SNTP_RETRY_TIMEOUT, request, client);
   }
 }
 
@@ -624,52 +1511,229 @@ send_request(const ip_addr_t *server_addr) {
  */
 static void ICACHE_FLASH_ATTR
 dns_found(const char *hostname, const ip_addr_t *ipaddr, void *arg) {
+  struct sntp_client *client = (struct sntp_client *)arg;
   LWIP_UNUSED_ARG(hostname);
-  LWIP_UNUSED_ARG(arg);
 
+  if (client->pcb == nullptr) {
+    /* stopped while resolving */
+    return;
+  }
+
+  trace(client, TRACE_RESOLVED, ipaddr != nullptr ? family_of(ipaddr) : TRACE_ARG_NONE);
   if (ipaddr != nullptr) {
     /* Address resolved, send request */
     log_v("Server address resolved, sending request");
-    send_request(ipaddr);
+    send_request(client, ipaddr);
   } else {
     /* DNS resolving failed -> try another server */
     log_w("Failed to resolve server address resolved, trying next server");
-    try_next_server(nullptr);
+    try_next_server(client);
   }
 }
 #endif /* SNTP_SERVER_DNS */
 
+#if SNTP_SUPPORT_DUAL_STACK
+/**
+ * Send a request over the next address family of the race, or wait for it (Happy Eyeballs, RFC 8305):
+ * the family which answered first the last time (or IPv6) is preferred, and the other one
+ * is sent after SNTP_RACE_DELAY if no response has come yet.
+ */
+static void ICACHE_FLASH_ATTR
+race_kick(struct sntp_client *client) {
+  if (client->race_wait)
+    return;
+
+  u8_t preferred = client->servers[client->current_server].family;
+  u8_t first     = preferred == SNTP_FAMILY_IPV4 ? SNTP_FAMILY_IPV4 : SNTP_FAMILY_IPV6;
+  u8_t second    = first == SNTP_FAMILY_IPV4 ? SNTP_FAMILY_IPV6 : SNTP_FAMILY_IPV4;
+  u8_t family;
+  if (client->race_ready & (1 << first)) {
+    family = first;
+  } else if ((client->race_ready & (1 << second)) &&
+             (client->race_waived || client->race_sent != 0 || (client->race_resolving & (1 << first)) == 0)) {
+    family = second;
+  } else if (client->race_ready & (1 << second)) {
+    /* give the preferred family a moment to be resolved */
+    client->race_wait = true;
+    sys_timeout((u32_t)SNTP_RESOLUTION_DELAY, race_next, client);
+    return;
+  } else {
+    if (client->race_sent == 0 && client->race_resolving == 0) {
+      /* DNS resolving failed for both families -> try another server */
+      log_w("Failed to resolve server address, trying next server");
+      try_next_server(client);
+    }
+    return;
+  }
+
+  client->race_ready &= (u8_t)~(1 << family);
+  log_v("Racing request over %s", family == SNTP_FAMILY_IPV6 ? "IPv6" : "IPv4");
+  send_request(client, &client->race_addr[family]);
+  if (client->race_ready != 0 || client->race_resolving != 0) {
+    /* race the other family if no response comes in a moment */
+    client->race_wait = true;
+    sys_timeout((u32_t)SNTP_RACE_DELAY, race_next, client);
+  }
+}
+
+/**
+ * The wait of the race elapsed.
+ *
+ * @param arg the client
+ */
+static void ICACHE_FLASH_ATTR
+race_next(void *arg) {
+  struct sntp_client *client = (struct sntp_client *)arg;
+  client->race_wait   = false;
+  client->race_waived = true;
+  race_kick(client);
+}
+
+/**
+ * The address of a family is resolved (or failed to be, if addr is nullptr).
+ */
+static void ICACHE_FLASH_ATTR
+race_resolved(struct sntp_client *client, u8_t family, const ip_addr_t *addr) {
+  u8_t bit = (u8_t)(1 << family);
+  if (client->pcb == nullptr || (client->race_resolving & bit) == 0) {
+    /* stopped, or the race is over */
+    return;
+  }
+
+  client->race_resolving &= (u8_t)~bit;
+  trace(client, TRACE_RESOLVED, addr != nullptr ? family : TRACE_ARG_NONE);
+  if (addr != nullptr) {
+    ip_addr_set(&client->race_addr[family], addr);
+    client->race_ready |= bit;
+  } else {
+    log_v("Failed to resolve server address over %s", family == SNTP_FAMILY_IPV6 ? "IPv6" : "IPv4");
+  }
+  if (client->race_wait && client->race_sent == 0) {
+    /* waited for this one: no need to wait any longer, whether it's resolved or not */
+    sys_untimeout(race_next, client);
+    client->race_wait = false;
+  }
+  race_kick(client);
+}
+
+static void ICACHE_FLASH_ATTR
+dns_found4(const char *hostname, const ip_addr_t *ipaddr, void *arg) {
+  LWIP_UNUSED_ARG(hostname);
+  race_resolved((struct sntp_client *)arg, SNTP_FAMILY_IPV4, ipaddr);
+}
+
+static void ICACHE_FLASH_ATTR
+dns_found6(const char *hostname, const ip_addr_t *ipaddr, void *arg) {
+  LWIP_UNUSED_ARG(hostname);
+  race_resolved((struct sntp_client *)arg, SNTP_FAMILY_IPV6, ipaddr);
+}
+
+/**
+ * Resolve the current server to both address families, and start the race.
+ */
+static void ICACHE_FLASH_ATTR
+race_start(struct sntp_client *client) {
+  const char *name = client->servers[client->current_server].name;
+
+  race_end(client);
+  client->race_resolving = (1 << SNTP_FAMILY_IPV4) | (1 << SNTP_FAMILY_IPV6);
+  client->race_waived    = false;
+  ip_addr_set_any(false, &client->servers[client->current_server].addr);
+  trace(client, TRACE_RESOLVE, client->current_server);
+
+  for (u8_t family = 0; family < SNTP_FAMILIES; family++) {
+    ip_addr_t addr;
+    err_t     err = dns_gethostbyname_addrtype(name, &addr,
+      family == SNTP_FAMILY_IPV6 ? dns_found6 : dns_found4, client,
+      family == SNTP_FAMILY_IPV6 ? LWIP_DNS_ADDRTYPE_IPV6 : LWIP_DNS_ADDRTYPE_IPV4);
+    if (err == ERR_OK) {
+      race_resolved(client, family, &addr);
+    } else if (err != ERR_INPROGRESS) {
+      race_resolved(client, family, nullptr);
+    }
+  }
+}
+
+/**
+ * Stop the race (pending DNS answers and late responses over either family are ignored).
+ */
+static void ICACHE_FLASH_ATTR
+race_end(struct sntp_client *client) {
+  sys_untimeout(race_next, client);
+  client->race_resolving = 0;
+  client->race_ready     = 0;
+  client->race_sent      = 0;
+  client->race_wait      = false;
+}
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+
 /**
  * Send out an sntp request.
  *
- * @param arg is unused (only necessary to conform to sys_timeout)
+ * @param arg the client
  */
 static void ICACHE_FLASH_ATTR
 request(void *arg) {
-  ip_addr_t sntp_server_address;
-  err_t     err;
+  struct sntp_client *client = (struct sntp_client *)arg;
+  ip_addr_t           sntp_server_address;
+  err_t               err;
 
-  LWIP_UNUSED_ARG(arg);
+  client->idle = false;
+  trace(client, TRACE_REQUEST, client->current_server);
+
+  if (!client->measure_only) {
+    /* a sync may be overdue */
+    pftime_hold::check();
+  }
+
+  if (client->servers[client->current_server].denied) {
+    /* access denied by Kiss-of-Death: never send to the server again */
+#if SNTP_SUPPORT_MULTIPLE_SERVERS
+    try_next_server(client);
+#else /* SNTP_SUPPORT_MULTIPLE_SERVERS */
+    log_e("Server denied access");
+    notify_fail(client, "All servers denied access");
+#endif /* SNTP_SUPPORT_MULTIPLE_SERVERS */
+    return;
+  }
+
+  u32_t hold = server_hold(client, client->current_server);
+  if (hold > 0) {
+    /* Kiss-of-Death "RATE": wait until the hold ends */
+    log_v("Server on hold, next request will be sent in %" U32_F " ms", hold);
+    trace(client, TRACE_HOLD, TRACE_ARG(hold / 1000));
+    sys_timeout(hold, request, client);
+    return;
+  }
+  client->last_request_ms = sys_now();
 
   /* initialize SNTP server address */
+#if SNTP_SUPPORT_DUAL_STACK
+  if (client->dual_stack && client->servers[client->current_server].name) {
+    /* resolve to both families and race requests over them */
+    race_start(client);
+    return;
+  }
+#endif /* SNTP_SUPPORT_DUAL_STACK */
 #if SNTP_SERVER_DNS
 
-  if (_servers[_current_server].name) {
+  if (client->servers[client->current_server].name) {
     /* always resolve the name and rely on dns-internal caching & timeout */
-    ip_addr_set_any(false, &_servers[_current_server].addr);
-    err = dns_gethostbyname(_servers[_current_server].name, &sntp_server_address,
-      dns_found, nullptr);
+    ip_addr_set_any(false, &client->servers[client->current_server].addr);
+    trace(client, TRACE_RESOLVE, client->current_server);
+    err = dns_gethostbyname(client->servers[client->current_server].name, &sntp_server_address,
+      dns_found, client);
     if (err == ERR_INPROGRESS) {
       /* DNS request sent, wait for dns_found being called */
       log_v("Waiting for server address to be resolved.");
       return;
     } else if (err == ERR_OK) {
-      _servers[_current_server].addr = sntp_server_address;
+      client->servers[client->current_server].addr = sntp_server_address;
     }
   } else
 #endif /* SNTP_SERVER_DNS */
   {
-    sntp_server_address = _servers[_current_server].addr;
+    sntp_server_address = client->servers[client->current_server].addr;
 //    os_printf("sntp_server_address ip %d\n",sntp_server_address.addr);
     err = (ip_addr_isany(&sntp_server_address)) ? ERR_ARG : ERR_OK;
   }
@@ -677,11 +1741,11 @@ request(void *arg) {
   if (err == ERR_OK) {
     log_d("current server address is %s",
       ipaddr_ntoa(&sntp_server_address));
-    send_request(&sntp_server_address);
+    send_request(client, &sntp_server_address);
   } else {
     /* address conversion failed, try another server */
     log_w("Invalid server address, trying next server.");
-    sys_timeout((u32_t)SNTP_RETRY_TIMEOUT, try_next_server, nullptr);
+    sys_timeout((u32_t)SNTP_RETRY_TIMEOUT, try_next_server, client);
   }
 }
 
@@ -701,6 +1765,61 @@ setfailcallback(pftime::fail_callback_t cb) {
   _failcb = cb;
 }
 
+/**
+ * Add a listener of sync events
+ */
+err_t ICACHE_FLASH_ATTR
+addlistener(pftime::event_callback_t cb, void *ctx) {
+  if (cb == nullptr)
+    return ERR_ARG;
+  for (u8_t i = 0; i < SNTP_MAX_LISTENERS; i++) {
+    if (_listeners[i].cb == nullptr) {
+      _listeners[i].ctx = ctx;
+      _listeners[i].cb  = cb;
+      return ERR_OK;
+    }
+  }
+  return ERR_MEM;
+}
+
+/**
+ * Remove a listener added by addlistener()
+ */
+void ICACHE_FLASH_ATTR
+removelistener(pftime::event_callback_t cb, void *ctx) {
+  for (u8_t i = 0; i < SNTP_MAX_LISTENERS; i++) {
+    if (_listeners[i].cb == cb && _listeners[i].ctx == ctx)
+      _listeners[i].cb = nullptr;
+  }
+}
+
+/**
+ * Take a client from the pool. It measures the offset without setting the system clock.
+ */
+struct sntp_client * ICACHE_FLASH_ATTR
+newclient(void) {
+  for (u8_t i = 0; i < SNTP_MAX_CLIENTS; i++) {
+    if (!_clients[i].used) {
+      _clients[i]              = sntp_client();
+      _clients[i].measure_only = true;
+      _clients[i].used         = true;
+      return &_clients[i];
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Stop the client and return it to the pool.
+ */
+void ICACHE_FLASH_ATTR
+deleteclient(struct sntp_client *client) {
+  if (client == nullptr || client == &_default)
+    return;
+  stop(client);
+  client->used = false;
+}
+
 /**
  * Initialize this module.
  * Send out request instantly or after SNTP_STARTUP_DELAY(_FUNC).
@@ -715,17 +1834,68 @@ init(void) {
 #endif
 #endif /* SNTP_SERVER_ADDRESS */
 
-  if (_sntp_pcb == nullptr) {
-    SNTP_RESET_RETRY_TIMEOUT();
-    _sntp_pcb = udp_new();
-    LWIP_ASSERT("Failed to allocate udp pcb for sntp client", _sntp_pcb != nullptr);
-    if (_sntp_pcb != nullptr) {
-      udp_recv(_sntp_pcb, recv, nullptr);
+  init(&_default);
+}
+
+void ICACHE_FLASH_ATTR
+init(struct sntp_client *client) {
+  if (client->pcb == nullptr) {
+    SNTP_RESET_RETRY_TIMEOUT(client);
+    os_memset(&client->stats, 0, sizeof(client->stats));
+    for (u8_t i = 0; i < SNTP_MAX_SERVERS; i++)
+      reset_server(&client->servers[i]);
+#if LWIP_IPV6
+    /* dual-stack pcb, to send to servers of both address families */
+    client->pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+#else /* LWIP_IPV6 */
+    client->pcb = udp_new();
+#endif /* LWIP_IPV6 */
+    LWIP_ASSERT("Failed to allocate udp pcb for sntp client", client->pcb != nullptr);
+    if (client->pcb != nullptr) {
+      udp_recv(client->pcb, recv, client);
+      client->idle = false;
+      if (!client->measure_only)
+        pftime_hold::onstart();
+#ifndef ESP8266
+      if (_waiters_lock == nullptr)
+        _waiters_lock = xSemaphoreCreateMutexStatic(&_waiters_lock_buf);
+#endif /* ESP8266 */
+#if SNTP_SUPPORT_BROADCAST
+      if (is_listenonly(client)) {
+        /* listen to broadcasts (through the server pcb if it owns the port) */
+        client->broadcast_delay_us = 0;
+        err_t err = ERR_OK;
+#if SNTP_SUPPORT_SERVER
+        if (_server_pcb == nullptr || _server_port != SNTP_PORT)
+#endif /* SNTP_SUPPORT_SERVER */
+          err = udp_bind(client->pcb, IP_ANY_TYPE, SNTP_PORT);
+        if (err != ERR_OK) {
+          log_e("Failed to bind port %" U16_F " for broadcasts", (u16_t)SNTP_PORT);
+          udp_remove(client->pcb);
+          client->pcb = nullptr;
+          notify_fail(client, "Failed to listen to broadcasts");
+          return;
+        }
+#if LWIP_IGMP
+        if (!ip_addr_isany(&client->multicast_group))
+          igmp_joingroup(IP4_ADDR_ANY4, ip_2_ip4(&client->multicast_group));
+#endif /* LWIP_IGMP */
+        if (!is_server_configured(client, 0)) {
+          /* no server to calibrate the delay */
+          return;
+        }
+      }
+#endif /* SNTP_SUPPORT_BROADCAST */
+      /* spread the first requests of devices started together */
+      u32_t delay = client->startup_jitter > 0 ? LWIP_RAND() % (client->startup_jitter + 1) : 0;
 #if SNTP_STARTUP_DELAY
-      sys_timeout((u32_t)SNTP_STARTUP_DELAY_FUNC, request, nullptr);
-#else
-      request(nullptr);
+      delay += (u32_t)SNTP_STARTUP_DELAY_FUNC;
 #endif
+      trace(client, TRACE_START, TRACE_ARG(delay));
+      if (delay > 0)
+        sys_timeout(delay, request, client);
+      else
+        request(client);
     }
   }
 }
@@ -735,10 +1905,24 @@ init(void) {
  */
 void ICACHE_FLASH_ATTR
 stop(void) {
-  if (_sntp_pcb != nullptr) {
-    sys_untimeout(request, nullptr);
-    udp_remove(_sntp_pcb);
-    _sntp_pcb = nullptr;
+  stop(&_default);
+}
+
+void ICACHE_FLASH_ATTR
+stop(struct sntp_client *client) {
+  if (client->pcb != nullptr) {
+    sys_untimeout(request, client);
+    sys_untimeout(try_next_server, client);
+#if SNTP_SUPPORT_DUAL_STACK
+    race_end(client);
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+#if SNTP_SUPPORT_BROADCAST && LWIP_IGMP
+    if (is_listenonly(client) && !ip_addr_isany(&client->multicast_group))
+      igmp_leavegroup(IP4_ADDR_ANY4, ip_2_ip4(&client->multicast_group));
+#endif /* SNTP_SUPPORT_BROADCAST && LWIP_IGMP */
+    udp_remove(client->pcb);
+    client->pcb = nullptr;
+    trace(client, TRACE_STOP, 0);
   }
 }
 
@@ -763,16 +1947,18 @@ void servermode_dhcp(int set_servers_from_dhcp) {
  */
 void ICACHE_FLASH_ATTR
 setserver(u8_t idx, ip_addr_t *server) {
+  struct sntp_client *client = &_default;
   if (idx < SNTP_MAX_SERVERS) {
     if (server != nullptr) {
-      _servers[idx].addr = (*server);
+      client->servers[idx].addr = (*server);
 //      os_printf("server ip %d\n",server->addr);
     } else {
-      ip_addr_set_any(false, &_servers[idx].addr);
+      ip_addr_set_any(false, &client->servers[idx].addr);
     }
 #if SNTP_SERVER_DNS
-    _servers[idx].name = nullptr;
+    client->servers[idx].name = nullptr;
 #endif
+    reset_server(&client->servers[idx]);
   }
 }
 
@@ -800,7 +1986,7 @@ void dhcp_set_ntp_servers(u8_t num, ip_addr_t *server) {
 #endif /* LWIP_DHCP && SNTP_GET_SERVERS_FROM_DHCP */
 
 /**
- * Obtain one of the currently configured by IP address (or DHCP) NTP servers 
+ * Obtain one of the currently configured by IP address (or DHCP) NTP servers
  *
  * @param numdns the index of the NTP server
  * @return IP address of the indexed NTP server or "ip_addr_any" if the NTP
@@ -809,7 +1995,7 @@ void dhcp_set_ntp_servers(u8_t num, ip_addr_t *server) {
 ip_addr_t ICACHE_FLASH_ATTR
 getserver(u8_t idx) {
   if (idx < SNTP_MAX_SERVERS) {
-    return _servers[idx].addr;
+    return _default.servers[idx].addr;
   }
   return *IP_ADDR_ANY;
 }
@@ -823,8 +2009,17 @@ getserver(u8_t idx) {
  */
 void ICACHE_FLASH_ATTR
 setservername(u8_t idx, const char *server) {
+  setservername(&_default, idx, server);
+}
+
+void ICACHE_FLASH_ATTR
+setservername(struct sntp_client *client, u8_t idx, const char *server) {
   if (idx < SNTP_MAX_SERVERS) {
-    _servers[idx].name = server;
+    client->servers[idx].name = server;
+    reset_server(&client->servers[idx]);
+#if SNTP_SUPPORT_DUAL_STACK
+    client->servers[idx].family = SNTP_FAMILY_UNKNOWN;
+#endif /* SNTP_SUPPORT_DUAL_STACK */
   }
 }
 
@@ -838,16 +2033,478 @@ setservername(u8_t idx, const char *server) {
 const char * ICACHE_FLASH_ATTR
 getservername(u8_t idx) {
   if (idx < SNTP_MAX_SERVERS) {
-    return _servers[idx].name;
+    return _default.servers[idx].name;
   }
   return nullptr;
 }
 #endif /* SNTP_SERVER_DNS */
 
 void ICACHE_FLASH_ATTR
-set_update_delay(uint32 ms) {
-	_update_delay = ms > 15000 ? ms : 15000;
+set_update_delay(u32_t ms) {
+  set_update_delay(&_default, ms);
+}
+
+void ICACHE_FLASH_ATTR
+set_update_delay(struct sntp_client *client, u32_t ms) {
+	client->update_delay = ms > SNTP_UPDATE_DELAY_MIN ? ms : SNTP_UPDATE_DELAY_MIN;
+}
+
+/**
+ * Set the max random delay of the first request, and the randomization of the update delay.
+ */
+void ICACHE_FLASH_ATTR
+setjitter(u32_t startup_ms, u8_t poll_percent) {
+  setjitter(&_default, startup_ms, poll_percent);
+}
+
+void ICACHE_FLASH_ATTR
+setjitter(struct sntp_client *client, u32_t startup_ms, u8_t poll_percent) {
+  client->startup_jitter = startup_ms;
+  client->poll_jitter    = poll_percent < 100 ? poll_percent : 100;
+}
+
+/**
+ * Send requests in interleaved mode, to servers which support it.
+ */
+void ICACHE_FLASH_ATTR
+setinterleaved(bool interleaved) {
+  setinterleaved(&_default, interleaved);
+}
+
+void ICACHE_FLASH_ATTR
+setinterleaved(struct sntp_client *client, bool interleaved) {
+#if SNTP_SUPPORT_INTERLEAVED
+  client->interleaved = interleaved;
+#else /* SNTP_SUPPORT_INTERLEAVED */
+  LWIP_UNUSED_ARG(client);
+  if (interleaved) {
+    log_e("Interleaved mode is not supported (SNTP_SUPPORT_INTERLEAVED == 0)");
+  }
+#endif /* SNTP_SUPPORT_INTERLEAVED */
+}
+
+/**
+ * Bring the next request forward, in lwIP thread.
+ *
+ * @param arg the client
+ */
+static void ICACHE_FLASH_ATTR
+sync_now(void *arg) {
+  struct sntp_client *client = (struct sntp_client *)arg;
+#ifndef ESP8266
+  __atomic_store_n(&_sync_now_queued, false, __ATOMIC_RELEASE);
+#endif /* ESP8266 */
+
+  if (client->pcb == nullptr || is_listenonly(client) || !client->idle) {
+    /* stopped, or a request is in progress or being retried: coalesced into it */
+    return;
+  }
+
+  /* a server which sent RATE asked for a longer interval, long after its hold_until expired */
+  u32_t interval = client->servers[client->current_server].rate_hold;
+  if (interval < SNTP_SYNC_NOW_MIN_INTERVAL)
+    interval = SNTP_SYNC_NOW_MIN_INTERVAL;
+
+  u32_t now     = sys_now();
+  u32_t elapsed = now - client->last_request_ms;
+  u32_t wait    = elapsed < interval ? interval - elapsed : 0;
+  if ((s32_t)(client->next_request_ms - now) <= (s32_t)wait) {
+    /* the next request comes as early anyway */
+    return;
+  }
+
+  sys_untimeout(request, client);
+  if (wait == 0) {
+    log_v("Sync requested, sending request");
+    request(client);
+  } else {
+    log_v("Sync requested, next request will be sent in %" U32_F " ms", wait);
+    sys_timeout(wait, request, client);
+    client->next_request_ms = now + wait;
+  }
+}
+
+/**
+ * Request a sync of the default instance as soon as possible (not before SNTP_SYNC_NOW_MIN_INTERVAL,
+ * or the RATE hold of the server, since the last request). Requests while syncing are coalesced.
+ *
+ * @return false if not started, in broadcast mode (or the request could not be queued to lwIP thread)
+ */
+bool ICACHE_FLASH_ATTR
+syncnow(void) {
+  if (_default.pcb == nullptr || is_listenonly(&_default))
+    return false;
+
+#ifdef ESP8266
+  /* lwIP runs in the same context */
+  sync_now(&_default);
+#else /* ESP8266 */
+  if (__atomic_exchange_n(&_sync_now_queued, true, __ATOMIC_ACQ_REL)) {
+    /* already queued */
+    return true;
+  }
+  if (tcpip_callback(sync_now, &_default) != ERR_OK) {
+    __atomic_store_n(&_sync_now_queued, false, __ATOMIC_RELEASE);
+    return false;
+  }
+#endif /* ESP8266 */
+  return true;
+}
+
+/**
+ * Block the calling task until the next successful sync of the default instance.
+ * Don't call this in lwIP thread (e.g. from the callbacks).
+ *
+ * @return false on timeout, or if not started
+ */
+bool ICACHE_FLASH_ATTR
+waitsync(u32_t timeout_ms) {
+  if (_default.pcb == nullptr)
+    return false;
+
+#ifdef ESP8266
+  /* suspend until woken up by esp_schedule() in wake_waiters() */
+  u32_t syncs = _syncs;
+  esp_delay(timeout_ms, [syncs]() { return _syncs == syncs; }, timeout_ms);
+  return _syncs != syncs;
+#else /* ESP8266 */
+  StaticSemaphore_t buf;
+  SemaphoreHandle_t sem  = xSemaphoreCreateBinaryStatic(&buf);
+  u8_t              slot = SNTP_MAX_WAITERS;
+  xSemaphoreTake(_waiters_lock, portMAX_DELAY);
+  for (u8_t i = 0; i < SNTP_MAX_WAITERS; i++) {
+    if (_waiters[i] == nullptr) {
+      _waiters[i] = sem;
+      slot        = i;
+      break;
+    }
+  }
+  xSemaphoreGive(_waiters_lock);
+  if (slot == SNTP_MAX_WAITERS) {
+    log_e("Too many tasks waiting for sync");
+    vSemaphoreDelete(sem);
+    return false;
+  }
+
+  bool synced = xSemaphoreTake(sem, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+
+  xSemaphoreTake(_waiters_lock, portMAX_DELAY);
+  _waiters[slot] = nullptr;
+  xSemaphoreGive(_waiters_lock);
+  vSemaphoreDelete(sem);
+  return synced;
+#endif /* ESP8266 */
+}
+
+/**
+ * Defer callbacks to dispatch(), instead of invoking them in lwIP thread.
+ */
+void ICACHE_FLASH_ATTR
+setdeferred(bool deferred) {
+#if SNTP_EVENT_QUEUE_SIZE > 0
+  _deferred = deferred;
+#else /* SNTP_EVENT_QUEUE_SIZE > 0 */
+  if (deferred) {
+    log_e("Deferred callbacks are not supported (SNTP_EVENT_QUEUE_SIZE == 0)");
+  }
+#endif /* SNTP_EVENT_QUEUE_SIZE > 0 */
+}
+
+/**
+ * Invoke deferred callbacks. Call this from only one task.
+ *
+ * @return number of dispatched events
+ */
+size_t ICACHE_FLASH_ATTR
+dispatch(void) {
+  size_t count = 0;
+#if SNTP_EVENT_QUEUE_SIZE > 0
+  u8_t   tail  = _events_tail;
+  while (tail != __atomic_load_n(&_events_head, __ATOMIC_ACQUIRE)) {
+    pftime::sync_event_t ev = _events[tail];
+    tail                    = (u8_t)((tail + 1) % SNTP_EVENT_QUEUE_SIZE);
+    __atomic_store_n(&_events_tail, tail, __ATOMIC_RELEASE);
+    invoke_callback(&ev);
+    count++;
+  }
+#endif /* SNTP_EVENT_QUEUE_SIZE > 0 */
+  return count;
+}
+
+/**
+ * Number of events dropped because the queue was full.
+ */
+u32_t ICACHE_FLASH_ATTR
+getdroppedevents(void) {
+#if SNTP_EVENT_QUEUE_SIZE > 0
+  return _events_dropped;
+#else /* SNTP_EVENT_QUEUE_SIZE > 0 */
+  return 0;
+#endif /* SNTP_EVENT_QUEUE_SIZE > 0 */
+}
+
+/**
+ * Copy the latest entries of the trace ring, oldest first, without removing them.
+ * Can be called from any task.
+ *
+ * @return number of entries stored
+ */
+size_t ICACHE_FLASH_ATTR
+gettrace(pftime::trace_entry_t *results, size_t count) {
+#if SNTP_TRACE_SIZE > 0
+  u32_t head  = __atomic_load_n(&_trace_head, __ATOMIC_ACQUIRE);
+  u32_t n     = head < SNTP_TRACE_SIZE ? head : SNTP_TRACE_SIZE;
+  if (n > count)
+    n = (u32_t)count;
+  u32_t first = head - n;
+
+  /* keep only the entries complete before and after the copy: writers may be in the middle
+   * of a slot, or have claimed it again meanwhile */
+  size_t stored = 0;
+  for (u32_t i = 0; i < n; i++) {
+    u32_t idx = (first + i) & (SNTP_TRACE_SIZE - 1);
+    u32_t seq = __atomic_load_n(&_trace_seq[idx], __ATOMIC_ACQUIRE);
+    results[stored] = _trace[idx];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq == first + i + 1 && seq == __atomic_load_n(&_trace_seq[idx], __ATOMIC_RELAXED))
+      stored++;
+  }
+  return stored;
+#else /* SNTP_TRACE_SIZE > 0 */
+  LWIP_UNUSED_ARG(results);
+  LWIP_UNUSED_ARG(count);
+  return 0;
+#endif /* SNTP_TRACE_SIZE > 0 */
+}
+
+/**
+ * Race requests over IPv4 and IPv6 to servers given by name. Takes effect on the next request.
+ */
+void ICACHE_FLASH_ATTR
+setdualstack(bool dual_stack) {
+  setdualstack(&_default, dual_stack);
+}
+
+void ICACHE_FLASH_ATTR
+setdualstack(struct sntp_client *client, bool dual_stack) {
+#if SNTP_SUPPORT_DUAL_STACK
+  client->dual_stack = dual_stack;
+#else /* SNTP_SUPPORT_DUAL_STACK */
+  LWIP_UNUSED_ARG(client);
+  if (dual_stack) {
+    log_e("Dual stack is not supported (SNTP_SUPPORT_DUAL_STACK == 0)");
+  }
+#endif /* SNTP_SUPPORT_DUAL_STACK */
+}
+
+/**
+ * Set SNTP_OPMODE_POLL or SNTP_OPMODE_LISTENONLY (broadcast mode).
+ * Takes effect on the next init().
+ */
+void ICACHE_FLASH_ATTR
+setoperatingmode(u8_t operating_mode) {
+#if SNTP_SUPPORT_BROADCAST
+  if (operating_mode == SNTP_OPMODE_POLL || operating_mode == SNTP_OPMODE_LISTENONLY)
+    _default.opmode = operating_mode;
+#else /* SNTP_SUPPORT_BROADCAST */
+  if (operating_mode != SNTP_OPMODE_POLL) {
+    log_e("Broadcast mode is not supported (SNTP_SUPPORT_BROADCAST == 0)");
+  }
+#endif /* SNTP_SUPPORT_BROADCAST */
+}
+
+#if LWIP_IGMP
+/**
+ * Set the multicast group joined in broadcast mode (nullptr: broadcast only)
+ */
+void ICACHE_FLASH_ATTR
+setmulticastgroup(const ip_addr_t *group) {
+#if SNTP_SUPPORT_BROADCAST
+  struct sntp_client *client = &_default;
+  if (group != nullptr)
+    ip_addr_set(&client->multicast_group, group);
+  else
+    ip_addr_set_any(false, &client->multicast_group);
+#else /* SNTP_SUPPORT_BROADCAST */
+  LWIP_UNUSED_ARG(group);
+#endif /* SNTP_SUPPORT_BROADCAST */
+}
+#endif /* LWIP_IGMP */
+
+const struct sntp_status * ICACHE_FLASH_ATTR
+getstatus(void) {
+  return &_default.status;
+}
+
+const struct sntp_status * ICACHE_FLASH_ATTR
+getstatus(const struct sntp_client *client) {
+  return &client->status;
+}
+
+const struct sntp_stats * ICACHE_FLASH_ATTR
+getstats(void) {
+  return &_default.stats;
+}
+
+const struct sntp_stats * ICACHE_FLASH_ATTR
+getstats(const struct sntp_client *client) {
+  return &client->stats;
+}
+
+#if SNTP_SUPPORT_SERVER
+/**
+ * Fill the reply to a client, except for transmit timestamp.
+ * The request in msg is overwritten in place.
+ */
+static void ICACHE_FLASH_ATTR
+initialize_reply(struct sntp_msg *msg, const struct timeval *rx) {
+  u8_t version = msg->li_vn_mode & SNTP_VERSION_MASK;
+  u8_t li;
+
+  /* the client's transmit timestamp is sent back as originate timestamp */
+  msg->originate_timestamp[0] = msg->transmit_timestamp[0];
+  msg->originate_timestamp[1] = msg->transmit_timestamp[1];
+  TIMEVAL_TO_SNTP(rx, msg->receive_timestamp);
+
+  if (_default.status.synced) {
+    struct timeval now;
+    ::gettimeofday(&now, nullptr);
+    s64_t age_us  = COMBINE_TO_USEC((s64_t)now.tv_sec, (s64_t)now.tv_usec) - COMBINE_TO_USEC((s64_t)_default.status.sync_time.tv_sec, (s64_t)_default.status.sync_time.tv_usec);
+    s64_t rtt_us  = _default.status.rtt_us > 0 ? _default.status.rtt_us : 0;
+    s64_t disp_us = rtt_us / 2 + (age_us > 0 ? age_us : 0) / USECS_IN_SEC * SNTP_SERVER_PHI_PPM;
+
+    li                   = pftime::getLeapIndicator();
+    msg->stratum         = _default.status.stratum < SNTP_STRATUM_MAX ? _default.status.stratum + 1 : SNTP_STRATUM_MAX;
+    msg->root_delay      = htonl(_default.status.root_delay + USEC_TO_NTP_SHORT(rtt_us));
+    msg->root_dispersion = htonl(_default.status.root_dispersion + USEC_TO_NTP_SHORT(disp_us));
+#if LWIP_IPV6
+    if (IP_IS_V6(&_default.status.server)) {
+      /* no room for IPv6 address: use a hash of it */
+      const u32_t *a = ip_2_ip6(&_default.status.server)->addr;
+      msg->reference_identifier = a[0] ^ a[1] ^ a[2] ^ a[3];
+    } else
+#endif /* LWIP_IPV6 */
+    {
+      msg->reference_identifier = ip4_addr_get_u32(ip_2_ip4(&_default.status.server));
+    }
+    TIMEVAL_TO_SNTP(&_default.status.sync_time, msg->reference_timestamp);
+  } else {
+    li                          = LI_ALARM_CONDITION;
+    msg->stratum                = SNTP_STRATUM_UNSYNC;
+    msg->root_delay             = 0;
+    msg->root_dispersion        = 0;
+    msg->reference_identifier   = 0;
+    msg->reference_timestamp[0] = 0;
+    msg->reference_timestamp[1] = 0;
+  }
+
+  msg->li_vn_mode = (u8_t)(li << 6) | version | SNTP_MODE_SERVER;
+  msg->precision  = (u8_t)(s8_t)SNTP_SERVER_PRECISION;
+}
+
+/** UDP recv callback for the server pcb */
+static void ICACHE_FLASH_ATTR
+server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  struct timeval rx;
+  /* take receive timestamp first */
+  pftime::gettimeofday(&rx, nullptr);
+  LWIP_UNUSED_ARG(arg);
+
+  u8_t li_vn_mode;
+  if (p->tot_len < SNTP_MSG_LEN ||
+      pbuf_copy_partial(p, &li_vn_mode, 1, SNTP_OFFSET_LI_VN_MODE) != 1) {
+    pbuf_free(p);
+    return;
+  }
+  if ((li_vn_mode & SNTP_MODE_MASK) != SNTP_MODE_CLIENT) {
+    if ((li_vn_mode & SNTP_MODE_MASK) == SNTP_MODE_BROADCAST &&
+        is_listenonly(&_default) && _default.pcb != nullptr) {
+      /* the server owns the port: pass broadcasts to the client */
+      recv(&_default, pcb, p, addr, port);
+      return;
+    }
+    pbuf_free(p);
+    return;
+  }
+
+  struct pbuf *q;
+  if (p->len >= SNTP_MSG_LEN) {
+    /* reply in place: no allocation on burst of requests */
+    q = p;
+    pbuf_realloc(q, SNTP_MSG_LEN);
+  } else {
+    /* chained pbuf: copy into a new one */
+    q = pbuf_alloc(PBUF_TRANSPORT, SNTP_MSG_LEN, PBUF_RAM);
+    if (q == nullptr) {
+      pbuf_free(p);
+      return;
+    }
+    pbuf_copy_partial(p, q->payload, SNTP_MSG_LEN, 0);
+    pbuf_free(p);
+  }
+
+  struct sntp_msg *msg = (struct sntp_msg *)q->payload;
+  initialize_reply(msg, &rx);
+
+  struct timeval tx;
+  pftime::gettimeofday(&tx, nullptr);
+  TIMEVAL_TO_SNTP(&tx, msg->transmit_timestamp);
+  udp_sendto(pcb, q, addr, port);
+  pbuf_free(q);
+}
+
+err_t ICACHE_FLASH_ATTR
+startserver(u16_t port) {
+  stopserver();
+
+  _server_pcb = udp_new();
+  if (_server_pcb == nullptr)
+    return ERR_MEM;
+
+  /* a client in broadcast mode may own the port: take it over, and pass it the broadcasts */
+  bool shared = port == SNTP_PORT && is_listenonly(&_default) && _default.pcb != nullptr;
+  if (shared)
+    udp_bind(_default.pcb, IP_ANY_TYPE, 0);
+
+  err_t err = udp_bind(_server_pcb, IP_ANY_TYPE, port);
+  if (err != ERR_OK) {
+    log_e("Failed to bind port %" U16_F, port);
+    udp_remove(_server_pcb);
+    _server_pcb = nullptr;
+    if (shared)
+      udp_bind(_default.pcb, IP_ANY_TYPE, SNTP_PORT);
+    return err;
+  }
+  _server_port = port;
+  udp_recv(_server_pcb, server_recv, nullptr);
+  log_d("Server started on port %" U16_F, port);
+  return ERR_OK;
+}
+
+void ICACHE_FLASH_ATTR
+stopserver(void) {
+  if (_server_pcb != nullptr) {
+    udp_remove(_server_pcb);
+    _server_pcb = nullptr;
+    if (_server_port == SNTP_PORT && is_listenonly(&_default) && _default.pcb != nullptr) {
+      /* give the port back to the client in broadcast mode */
+      if (udp_bind(_default.pcb, IP_ANY_TYPE, SNTP_PORT) != ERR_OK)
+        notify_fail(&_default, "Failed to listen to broadcasts");
+    }
+  }
+}
+#else /* SNTP_SUPPORT_SERVER */
+err_t ICACHE_FLASH_ATTR
+startserver(u16_t port) {
+  LWIP_UNUSED_ARG(port);
+  log_e("Server mode is not supported (SNTP_SUPPORT_SERVER == 0)");
+  return ERR_VAL;
+}
+
+void ICACHE_FLASH_ATTR
+stopserver(void) {
 }
+#endif /* SNTP_SUPPORT_SERVER */
 
 } // namespace pftime_sntp
 
@@ -10,6 +10,9 @@
 #endif // ESP8266
 #include "ESPPerfectTime.h"
 #include <arch/cc.h>
+#include <lwip/err.h>
+#include <lwip/ip_addr.h>
+#include <lwip/pbuf.h>
 
 /** Set this to 1 to allow config of SNTP server(s) by DNS name */
 #ifndef SNTP_SERVER_DNS
@@ -28,6 +31,49 @@
 
 namespace pftime_sntp {
 
+/**
+ * State of a client (opaque)
+ */
+struct sntp_client;
+
+/**
+ * Status of the last successful sync
+ */
+struct sntp_status {
+  bool           synced;
+  u8_t           li;
+  u8_t           stratum;         // stratum of the server
+  u32_t          root_delay;      // root delay of the server (NTP short format)
+  u32_t          root_dispersion; // root dispersion of the server (NTP short format)
+  ip_addr_t      server;
+  struct timeval sync_time;       // system time just after syncing
+  int64_t        offset_us;       // offset applied to the system clock
+  int64_t        rtt_us;          // round-trip delay (0 for broadcast)
+};
+
+/**
+ * Get status of the last successful sync
+ */
+const struct sntp_status *getstatus(void);
+const struct sntp_status *getstatus(const struct sntp_client *client);
+
+/**
+ * Counters of the exchanges since init(), e.g. to evaluate tuning with a simulator.
+ * Requests without any response are (requests - accepted - rejected - kod).
+ */
+struct sntp_stats {
+  u32_t requests; // requests sent
+  u32_t accepted; // valid responses (and broadcasts)
+  u32_t rejected; // responses failed the sanity checks
+  u32_t kod;      // Kiss-of-Death or LI_ALARM_CONDITION responses
+};
+
+/**
+ * Get counters of the exchanges
+ */
+const struct sntp_stats *getstats(void);
+const struct sntp_stats *getstats(const struct sntp_client *client);
+
 /**
  * Set SNTP sync callback
  */
@@ -38,15 +84,99 @@ void setsynccallback(pftime::sync_callback_t);
  */
 void setfailcallback(pftime::fail_callback_t);
 
+/**
+ * Add a listener of sync events
+ *
+ * @return ERR_OK, or ERR_MEM if no room for the listener
+ */
+err_t addlistener(pftime::event_callback_t cb, void *ctx);
+
+/**
+ * Remove a listener added by addlistener()
+ */
+void removelistener(pftime::event_callback_t cb, void *ctx);
+
+/**
+ * Defer callbacks to dispatch(), instead of invoking them in lwIP thread.
+ */
+void setdeferred(bool deferred);
+
+/**
+ * Invoke deferred callbacks. Call this from only one task.
+ *
+ * @return number of dispatched events
+ */
+size_t dispatch(void);
+
+/**
+ * Number of events dropped because the queue was full.
+ */
+u32_t getdroppedevents(void);
+
+/**
+ * Copy the latest entries of the trace ring, oldest first, without removing them.
+ * Can be called from any task.
+ *
+ * @return number of entries stored
+ */
+size_t gettrace(pftime::trace_entry_t *results, size_t count);
+
+/**
+ * Request a sync as soon as possible, but not within SNTP_SYNC_NOW_MIN_INTERVAL (or the RATE hold
+ * of the server) of the last request. Requests while syncing are coalesced into it. Never blocks.
+ * Returns false if not started, or in broadcast mode.
+ */
+bool syncnow(void);
+
+/**
+ * Block the calling task until the next successful sync, or the timeout (in milliseconds).
+ */
+bool waitsync(u32_t timeout_ms);
+
+/**
+ * Check a response (or a broadcast) and extract the timestamps.
+ * The pbuf may be chained; the header is parsed in place when it is contiguous.
+ * This is the entry point for the untrusted input (fuzzed by tools/fuzz).
+ *
+ * @param li   leap indicator
+ * @param mode SNTP_MODE_SERVER or SNTP_MODE_BROADCAST
+ * @param originate_timestamp as sent by us (2 words, only for SNTP_MODE_SERVER)
+ * @param receive_timestamp   network byte order (2 words, only for SNTP_MODE_SERVER)
+ * @param transmit_timestamp  network byte order (2 words)
+ * @return ERR_OK, SNTP_ERR_KOD or ERR_ARG
+ */
+err_t recv_check(struct sntp_client *client,
+                 struct pbuf *p, const ip_addr_t *addr, const u16_t port,
+                 u8_t  *li,
+                 u8_t  *mode,
+                 u32_t *originate_timestamp,
+                 u32_t *receive_timestamp,
+                 u32_t *transmit_timestamp);
+
+/**
+ * Take a client from the pool (SNTP_MAX_CLIENTS).
+ * It only measures the offset and RTT of its servers, without setting the
+ * system clock or invoking the callbacks.
+ *
+ * @return nullptr if the pool is exhausted
+ */
+struct sntp_client *newclient(void);
+/**
+ * Stop the client and return it to the pool.
+ */
+void deleteclient(struct sntp_client *client);
+
 /**
  * Initialize this module.
  * Send out request instantly or after SNTP_STARTUP_DELAY(_FUNC).
  */
 void init(void);
+void init(struct sntp_client *client);
 /**
  * Stop this module.
  */
 void stop(void);
+void stop(struct sntp_client *client);
 #if SNTP_SERVER_DNS
 /**
  * Initialize one of the NTP servers by name
@@ -55,6 +185,7 @@ void stop(void);
  * @param dnsserver DNS name of the NTP server to set, to be resolved at contact time
  */
 void setservername(u8_t idx, const char *server);
+void setservername(struct sntp_client *client, u8_t idx, const char *server);
 /**
  * Obtain one of the currently configured by name NTP servers.
  *
@@ -64,6 +195,59 @@ void setservername(u8_t idx, const char *server);
  */
 const char *getservername(u8_t idx);
 #endif /* SNTP_SERVER_DNS */
+
+/**
+ * Set the interval of requests after a successful sync (at least 15 seconds)
+ */
+void set_update_delay(u32_t ms);
+void set_update_delay(struct sntp_client *client, u32_t ms);
+
+/**
+ * Set the max random delay (in milliseconds) of the first request after init(),
+ * and the randomization (in percent) of the update delay. The former takes effect on the next init().
+ */
+void setjitter(u32_t startup_ms, u8_t poll_percent);
+void setjitter(struct sntp_client *client, u32_t startup_ms, u8_t poll_percent);
+
+/**
+ * Send requests in interleaved mode (draft-ietf-ntp-interleaved-modes), to servers which support it.
+ * Each basic exchange is followed by a request after SNTP_INTERLEAVED_DELAY, whose response
+ * carries the transmit timestamp of the previous response captured when it left the server.
+ */
+void setinterleaved(bool interleaved);
+void setinterleaved(struct sntp_client *client, bool interleaved);
+
+/**
+ * Resolve servers given by name to both IPv4 and IPv6 addresses and race requests over them
+ * (on by default when built with SNTP_SUPPORT_DUAL_STACK), or use only the address returned by dns_gethostbyname().
+ */
+void setdualstack(bool dual_stack);
+void setdualstack(struct sntp_client *client, bool dual_stack);
+
+/**
+ * Set SNTP_OPMODE_POLL or SNTP_OPMODE_LISTENONLY (broadcast mode) of the default client.
+ * In broadcast mode, the propagation delay is calibrated by a unicast
+ * exchange with server 0 (if configured), then the time is synced only
+ * from received broadcasts.
+ */
+void setoperatingmode(u8_t operating_mode);
+#if LWIP_IGMP
+/**
+ * Set the multicast group joined in broadcast mode (nullptr: broadcast only)
+ */
+void setmulticastgroup(const ip_addr_t *group);
+#endif /* LWIP_IGMP */
+
+/**
+ * Start answering SNTP requests from other hosts with our clock.
+ *
+ * @param port UDP port to listen
+ */
+err_t startserver(u16_t port);
+/**
+ * Stop answering SNTP requests.
+ */
+void stopserver(void);
 } // namespace pftime_sntp
 
 #endif // ESPPERFECTTIME_SNTP_H_
@@ -0,0 +1,245 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+#include <stamp_pt.h>
+
+#define USECS_PER_SEC         1000000LL
+#define STAMP_QUEUE_MASK      (PFTIME_STAMP_QUEUE_SIZE - 1)
+#define STAMP_MAX_EXTRAPOLATE (1LL << 40) // about 12 days, keeps the drift calculation in 64 bits
+
+#if (PFTIME_STAMP_QUEUE_SIZE & STAMP_QUEUE_MASK) != 0
+#error "PFTIME_STAMP_QUEUE_SIZE must be a power of two"
+#endif
+
+namespace pftime_stamp {
+
+/**
+ * A slot of the bounded multi-producer / single-consumer ring.
+ * seq tells who owns the slot: (position) for producers, (position + 1) for the consumer.
+ * It is stored minus the slot index so that the zero-initialized ring is ready without setup.
+ */
+struct stamp_slot {
+  volatile uint32_t seq;
+  uint32_t          tag;
+  int64_t           raw_us;
+};
+
+static struct stamp_slot _ring[PFTIME_STAMP_QUEUE_SIZE];
+static volatile uint32_t _head;    // next position to write, shared by producers
+static uint32_t          _tail;    // next position to read, only used by the consumer
+static volatile uint32_t _dropped;
+
+/** Offset between the counter and UTC at each sync, oldest first, with the leap second announced then */
+struct stamp_sync {
+  int64_t raw_us;
+  int64_t offset_us;
+  time_t  leap_time;
+  uint8_t li;
+};
+
+static struct stamp_sync _history[PFTIME_STAMP_HISTORY_SIZE];
+static uint8_t           _history_count;
+static volatile uint32_t _history_seq; // odd while being updated
+
+static inline uint32_t IRAM_ATTR load_seq(uint32_t idx) {
+  return __atomic_load_n(&_ring[idx].seq, __ATOMIC_ACQUIRE) + idx;
+}
+
+static inline void IRAM_ATTR store_seq(uint32_t idx, uint32_t seq) {
+  __atomic_store_n(&_ring[idx].seq, seq - idx, __ATOMIC_RELEASE);
+}
+
+/**
+ * Reserve a position to write. ISRs may nest or run on the other core.
+ */
+static inline bool IRAM_ATTR reserve(uint32_t *pos) {
+#ifdef ESP8266
+  // Single core: masking interrupts is cheaper than emulated atomics
+  uint32_t saved = xt_rsil(15);
+  uint32_t p     = _head;
+  bool     ok    = load_seq(p & STAMP_QUEUE_MASK) == p;
+  if (ok)
+    _head = p + 1;
+  else
+    _dropped++;
+  xt_wsr_ps(saved);
+  *pos = p;
+  return ok;
+#else
+  uint32_t p = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+  for (;;) {
+    int32_t diff = (int32_t)(load_seq(p & STAMP_QUEUE_MASK) - p);
+    if (diff < 0) {
+      __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED); // full
+      return false;
+    }
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&_head, &p, p + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *pos = p;
+        return true;
+      }
+    } else {
+      p = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+    }
+  }
+#endif
+}
+
+bool IRAM_ATTR capture(uint32_t tag) {
+  int64_t  raw = monotonic_us();
+  uint32_t pos;
+  if (!reserve(&pos))
+    return false;
+
+  uint32_t idx      = pos & STAMP_QUEUE_MASK;
+  _ring[idx].raw_us = raw;
+  _ring[idx].tag    = tag;
+  store_seq(idx, pos + 1);
+  return true;
+}
+
+void onsync(const struct timeval *tv, uint8_t li, time_t leap_time) {
+  int64_t raw    = monotonic_us();
+  int64_t offset = (int64_t)tv->tv_sec * USECS_PER_SEC + tv->tv_usec - raw;
+
+  __atomic_store_n(&_history_seq, _history_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  if (_history_count == PFTIME_STAMP_HISTORY_SIZE) {
+    for (uint8_t i = 1; i < PFTIME_STAMP_HISTORY_SIZE; i++)
+      _history[i - 1] = _history[i];
+    _history_count--;
+  }
+  _history[_history_count].raw_us    = raw;
+  _history[_history_count].offset_us = offset;
+  _history[_history_count].leap_time = leap_time;
+  _history[_history_count].li        = li;
+  _history_count++;
+  __atomic_store_n(&_history_seq, _history_seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline bool is_slew(int64_t from, int64_t to) {
+  int64_t diff = to - from;
+  return diff > -PFTIME_STAMP_MAX_SLEW_US && diff < PFTIME_STAMP_MAX_SLEW_US;
+}
+
+/**
+ * Offset of the sync b, without the leap second announced by the earlier sync a
+ * if it has taken effect by b, so that both are on the same (leap-free) time scale.
+ */
+static int64_t unleaped(const struct stamp_sync *a, const struct stamp_sync *b) {
+  if (a->li != LI_LAST_MINUTE_61_SEC && a->li != LI_LAST_MINUTE_59_SEC)
+    return b->offset_us;
+  if ((b->raw_us + b->offset_us) / USECS_PER_SEC <= (int64_t)a->leap_time)
+    return b->offset_us;
+  return b->offset_us + (a->li == LI_LAST_MINUTE_61_SEC ? USECS_PER_SEC : -USECS_PER_SEC);
+}
+
+/**
+ * Offset between the counter and UTC at raw_us (without leap seconds),
+ * and the sync whose leap second applies (nullptr if none).
+ */
+static int64_t offset_at(const struct stamp_sync *h, uint8_t n, int64_t raw_us, const struct stamp_sync **leap) {
+  if (n == 0) {
+    // Never synced: trust the system clock
+    struct timeval now;
+    ::gettimeofday(&now, nullptr);
+    *leap = nullptr;
+    return (int64_t)now.tv_sec * USECS_PER_SEC + now.tv_usec - monotonic_us();
+  }
+
+  // Before the first sync the clock was not set, so the first sync corrects it
+  if (raw_us < h[0].raw_us) {
+    *leap = &h[0];
+    return h[0].offset_us;
+  }
+
+  uint8_t i = n - 1;
+  while (h[i].raw_us > raw_us)
+    i--;
+  *leap = &h[i];
+
+  if (i < n - 1) {
+    // Between two syncs: the clock drifted linearly from one offset to the other
+    int64_t next = unleaped(&h[i], &h[i + 1]);
+    if (!is_slew(h[i].offset_us, next))
+      return next;
+    return h[i].offset_us + (next - h[i].offset_us) * (raw_us - h[i].raw_us) / (h[i + 1].raw_us - h[i].raw_us);
+  }
+
+  // After the last sync: extrapolate the drift of the last interval
+  if (i == 0 || h[i].raw_us == h[i - 1].raw_us)
+    return h[i].offset_us;
+  int64_t prev = h[i].offset_us - (unleaped(&h[i - 1], &h[i]) - h[i - 1].offset_us);
+  if (!is_slew(prev, h[i].offset_us))
+    return h[i].offset_us;
+  int64_t elapsed = raw_us - h[i].raw_us;
+  if (elapsed > STAMP_MAX_EXTRAPOLATE)
+    elapsed = STAMP_MAX_EXTRAPOLATE;
+  return h[i].offset_us + (h[i].offset_us - prev) * elapsed / (h[i].raw_us - h[i - 1].raw_us);
+}
+
+/**
+ * Apply the leap second announced by the sync, in the same way as pftime::gettimeofday().
+ */
+static void apply_leap(const struct stamp_sync *s, time_t *t) {
+  if (s == nullptr)
+    return;
+  if (s->li == LI_LAST_MINUTE_61_SEC && *t > s->leap_time)
+    (*t)--;
+  else if (s->li == LI_LAST_MINUTE_59_SEC && *t >= s->leap_time)
+    (*t)++;
+}
+
+static uint8_t copy_history(struct stamp_sync *h) {
+  uint32_t seq;
+  uint8_t  n;
+  do {
+    seq = __atomic_load_n(&_history_seq, __ATOMIC_ACQUIRE);
+    n   = _history_count;
+    for (uint8_t i = 0; i < n; i++)
+      h[i] = _history[i];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) != 0 || seq != __atomic_load_n(&_history_seq, __ATOMIC_RELAXED));
+  return n;
+}
+
+static void to_timeval(int64_t usec, struct timeval *tv) {
+  int64_t sec = usec / USECS_PER_SEC;
+  usec %= USECS_PER_SEC;
+  if (usec < 0) {
+    usec += USECS_PER_SEC;
+    sec--;
+  }
+  tv->tv_sec  = (time_t)sec;
+  tv->tv_usec = (suseconds_t)usec;
+}
+
+size_t drain(pftime::timestamp_t *out, size_t count) {
+  struct stamp_sync h[PFTIME_STAMP_HISTORY_SIZE];
+  uint8_t           n = copy_history(h);
+
+  size_t i = 0;
+  while (i < count) {
+    uint32_t idx = _tail & STAMP_QUEUE_MASK;
+    if (load_seq(idx) != _tail + 1)
+      break; // empty, or the producer has not finished writing
+
+    int64_t raw = _ring[idx].raw_us;
+    out[i].tag  = _ring[idx].tag;
+    store_seq(idx, _tail + PFTIME_STAMP_QUEUE_SIZE);
+    _tail++;
+
+    const struct stamp_sync *leap;
+    to_timeval(raw + offset_at(h, n, raw, &leap), &out[i].tv);
+    apply_leap(leap, &out[i].tv.tv_sec);
+    i++;
+  }
+  return i;
+}
+
+uint32_t getdropped(void) {
+  return _dropped;
+}
+
+} // namespace pftime_stamp
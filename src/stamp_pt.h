@@ -0,0 +1,77 @@
+#ifndef ESPPERFECTTIME_STAMP_H_
+#define ESPPERFECTTIME_STAMP_H_
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+#ifdef ESP32
+#include <esp_timer.h>
+#endif // ESP32
+#include "ESPPerfectTime.h"
+
+/** Number of timestamps the ring can hold (must be a power of two) */
+#ifndef PFTIME_STAMP_QUEUE_SIZE
+#define PFTIME_STAMP_QUEUE_SIZE 64
+#endif
+
+/** Number of syncs remembered to convert timestamps */
+#ifndef PFTIME_STAMP_HISTORY_SIZE
+#define PFTIME_STAMP_HISTORY_SIZE 4
+#endif
+
+/** Offset changes not smaller than this (in microseconds) are treated as steps, not as drift (keep it well below a leap second) */
+#ifndef PFTIME_STAMP_MAX_SLEW_US
+#define PFTIME_STAMP_MAX_SLEW_US 500000
+#endif
+
+namespace pftime_stamp {
+
+/**
+ * The monotonic microsecond counter, which is safe to read from ISRs.
+ */
+static inline int64_t monotonic_us(void) {
+#ifdef ESP32
+  return esp_timer_get_time();
+#else
+  return (int64_t)micros64();
+#endif
+}
+
+/**
+ * Record the current counter value with tag. Can be called from ISRs
+ * (also from several ISRs at once).
+ *
+ * @return false if the ring is full
+ */
+bool capture(uint32_t tag);
+
+/**
+ * Remember the offset between the counter and UTC when the clock is set,
+ * with the leap second in effect until the next sync.
+ *
+ * @param tv        UNIX time just set
+ * @param li        leap indicator of the sync
+ * @param leap_time the last second of the month when li announces a leap second
+ */
+void onsync(const struct timeval *tv, uint8_t li, time_t leap_time);
+
+/**
+ * Take timestamps out of the ring and convert them into UNIX time,
+ * using the offsets of the syncs before and after each of them (interpolated)
+ * so that timestamps captured before a sync are corrected by that sync.
+ * Leap seconds are applied as announced when each timestamp was captured.
+ * Only one task may call this.
+ *
+ * @return the number of timestamps stored in out
+ */
+size_t drain(pftime::timestamp_t *out, size_t count);
+
+/**
+ * The number of timestamps dropped because the ring was full.
+ */
+uint32_t getdropped(void);
+
+} // namespace pftime_stamp
+
+#endif // ESPPERFECTTIME_STAMP_H_
@@ -0,0 +1,367 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <time.h>
+#include "ESPPerfectTime.h"
+#include <civil_pt.h>
+#include <tz_pt.h>
+
+#define TZ_SECS_PER_HOUR    3600
+#define TZ_DEFAULT_DST_TIME (2 * TZ_SECS_PER_HOUR)
+#define TZ_MAX_RULE_HOURS   167 // RFC 8536 extension
+
+namespace pftime_tz {
+
+/** A date rule of DST transition */
+struct tz_date {
+  char     type; // 'J' (Julian day 1-365), 'N' (zero-based day 0-365) or 'M' (Mm.w.d)
+  uint16_t n;    // day for 'J' and 'N'
+  uint8_t  m;    // month for 'M'
+  uint8_t  w;    // week for 'M' (5 = last)
+  uint8_t  d;    // day of week for 'M' (0 = Sunday)
+  long     time; // local time of the transition (in seconds)
+};
+
+/** Precompiled TZ rules with the cache of the current period */
+struct tz_rules {
+  bool    valid;
+  bool    has_dst;
+  long    std_offset; // positive to east
+  long    dst_offset; // positive to east
+  tz_date start;
+  tz_date end;
+
+  time_t  cache_from;
+  time_t  cache_until;
+  long    cache_offset;
+  int     cache_isdst;
+};
+
+/**
+ * Shared by all tasks (e.g. pftime::localtime() and the scheduler), so it is only copied out and published
+ * as a whole under a sequence lock: a reader never mixes the period of one transition with the offset of another.
+ */
+static tz_rules          _rules;
+static volatile uint32_t _rules_seq; // odd while being updated
+
+static bool parse_name(const char **p) {
+  const char *s = *p;
+  if (*s == '<') {
+    const char *q = ++s;
+    while (*q && *q != '>')
+      q++;
+    if (*q != '>' || q - s < 3)
+      return false;
+    *p = q + 1;
+    return true;
+  }
+
+  const char *q = s;
+  while ((*q >= 'A' && *q <= 'Z') || (*q >= 'a' && *q <= 'z'))
+    q++;
+  if (q - s < 3)
+    return false;
+  *p = q;
+  return true;
+}
+
+static bool parse_number(const char **p, long max, long *result) {
+  const char *s = *p;
+  long        n = 0;
+  if (*s < '0' || *s > '9')
+    return false;
+  while (*s >= '0' && *s <= '9') {
+    n = n * 10 + (*s++ - '0');
+    if (n > max)
+      return false;
+  }
+  *p      = s;
+  *result = n;
+  return true;
+}
+
+/**
+ * Parse [+|-]hh[:mm[:ss]] into seconds.
+ */
+static bool parse_time(const char **p, long max_hours, long *secs) {
+  int sign = 1;
+  if (**p == '+' || **p == '-') {
+    sign = **p == '-' ? -1 : 1;
+    (*p)++;
+  }
+
+  long h, m = 0, s = 0;
+  if (!parse_number(p, max_hours, &h))
+    return false;
+  if (**p == ':') {
+    (*p)++;
+    if (!parse_number(p, 59, &m))
+      return false;
+    if (**p == ':') {
+      (*p)++;
+      if (!parse_number(p, 59, &s))
+        return false;
+    }
+  }
+  *secs = sign * (h * TZ_SECS_PER_HOUR + m * 60 + s);
+  return true;
+}
+
+static bool parse_date(const char **p, tz_date *date) {
+  long n, w, d;
+  if (**p == 'J') {
+    (*p)++;
+    if (!parse_number(p, 365, &n) || n < 1)
+      return false;
+    date->type = 'J';
+    date->n    = (uint16_t)n;
+  } else if (**p == 'M') {
+    (*p)++;
+    if (!parse_number(p, 12, &n) || n < 1 || *(*p)++ != '.' ||
+        !parse_number(p, 5, &w) || w < 1 || *(*p)++ != '.' ||
+        !parse_number(p, 6, &d))
+      return false;
+    date->type = 'M';
+    date->m    = (uint8_t)n;
+    date->w    = (uint8_t)w;
+    date->d    = (uint8_t)d;
+  } else {
+    if (!parse_number(p, 365, &n))
+      return false;
+    date->type = 'N';
+    date->n    = (uint16_t)n;
+  }
+
+  date->time = TZ_DEFAULT_DST_TIME;
+  if (**p == '/') {
+    (*p)++;
+    return parse_time(p, TZ_MAX_RULE_HOURS, &date->time);
+  }
+  return true;
+}
+
+static bool parse(const char *s, tz_rules *r) {
+  long off;
+
+  if (*s == ':')
+    return false; // implementation-defined format
+
+  r->has_dst = false;
+  if (*s == '\0') {
+    // Empty TZ means UTC
+    r->std_offset = 0;
+    return true;
+  }
+
+  if (!parse_name(&s) || !parse_time(&s, 24, &off))
+    return false;
+  r->std_offset = -off; // POSIX offset is positive to west
+  if (*s == '\0')
+    return true;
+
+  if (!parse_name(&s))
+    return false;
+  r->has_dst    = true;
+  r->dst_offset = r->std_offset + TZ_SECS_PER_HOUR;
+  if (*s != ',' && *s != '\0') {
+    if (!parse_time(&s, 24, &off))
+      return false;
+    r->dst_offset = -off;
+  }
+
+  if (*s == '\0') {
+    // Default rule is the same as newlib's: M3.2.0,M11.1.0
+    r->start = {'M', 0, 3, 2, 0, TZ_DEFAULT_DST_TIME};
+    r->end   = {'M', 0, 11, 1, 0, TZ_DEFAULT_DST_TIME};
+    return true;
+  }
+
+  if (*s++ != ',' || !parse_date(&s, &r->start) || *s++ != ',' || !parse_date(&s, &r->end))
+    return false;
+  return *s == '\0';
+}
+
+/**
+ * UNIX time of the transition in year y.
+ *
+ * @param local_offset The offset in effect just before the transition
+ */
+static time_t transition(const tz_date *date, int y, long local_offset) {
+  long jan1 = pftime_civil::days_from_civil(y, 1, 1);
+  long days;
+
+  if (date->type == 'J') {
+    // Feb 29 is never counted
+    days = jan1 + date->n - 1 + (pftime_civil::is_leap_year(y) && date->n >= 60 ? 1 : 0);
+  } else if (date->type == 'N') {
+    days = jan1 + date->n;
+  } else {
+    static const uint8_t mdays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    long first = pftime_civil::days_from_civil(y, date->m, 1);
+    int  last  = mdays[date->m - 1] + (date->m == 2 && pftime_civil::is_leap_year(y) ? 1 : 0);
+    int  mday  = 1 + (date->d - pftime_civil::weekday(first) + 7) % 7 + (date->w - 1) * 7;
+    while (mday > last)
+      mday -= 7;
+    days = first + mday - 1;
+  }
+
+  return (time_t)days * CIVIL_SECS_PER_DAY + date->time - local_offset;
+}
+
+/**
+ * Find the period containing utc, and cache it in rules.
+ */
+static void update_cache(tz_rules *rules, time_t utc) {
+  long     secs;
+  int      y;
+  unsigned m, d;
+  pftime_civil::civil_from_days(pftime_civil::split_days(utc, &secs), &y, &m, &d);
+
+  // Transitions of the previous, current and next year, sorted by time
+  time_t tr[6];
+  bool   to_dst[6];
+  for (int i = 0; i < 3; i++) {
+    tr[i * 2]         = transition(&rules->start, y - 1 + i, rules->std_offset);
+    to_dst[i * 2]     = true;
+    tr[i * 2 + 1]     = transition(&rules->end, y - 1 + i, rules->dst_offset);
+    to_dst[i * 2 + 1] = false;
+  }
+  for (int i = 1; i < 6; i++) {
+    for (int j = i; j > 0 && tr[j - 1] > tr[j]; j--) {
+      time_t t      = tr[j - 1];
+      bool   b      = to_dst[j - 1];
+      tr[j - 1]     = tr[j];
+      tr[j]         = t;
+      to_dst[j - 1] = to_dst[j];
+      to_dst[j]     = b;
+    }
+  }
+
+  int i = 5;
+  while (i >= 0 && tr[i] > utc)
+    i--;
+
+  if (i < 0) {
+    rules->cache_isdst = to_dst[0] ? 0 : 1;
+    rules->cache_from  = utc;
+    rules->cache_until = tr[0];
+  } else {
+    rules->cache_isdst = to_dst[i] ? 1 : 0;
+    rules->cache_from  = tr[i];
+    rules->cache_until = i < 5 ? tr[i + 1] : utc + 1;
+  }
+  rules->cache_offset = rules->cache_isdst ? rules->dst_offset : rules->std_offset;
+}
+
+/**
+ * Copy the shared rules consistently.
+ *
+ * @return the sequence number they were copied at
+ */
+static uint32_t load(tz_rules *rules) {
+  uint32_t seq;
+  do {
+    seq = __atomic_load_n(&_rules_seq, __ATOMIC_ACQUIRE);
+    *rules = _rules;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) != 0 || seq != __atomic_load_n(&_rules_seq, __ATOMIC_RELAXED));
+  return seq;
+}
+
+/**
+ * Become the only writer of the shared rules, if they are still at the even sequence number seq.
+ */
+static bool claim(uint32_t seq) {
+  if ((seq & 1) != 0)
+    return false;
+#ifdef ESP8266
+  // Single core: masking interrupts is cheaper than emulated atomics
+  uint32_t saved = xt_rsil(15);
+  bool     ok    = _rules_seq == seq;
+  if (ok)
+    _rules_seq = seq + 1;
+  xt_wsr_ps(saved);
+  return ok;
+#else
+  return __atomic_compare_exchange_n(&_rules_seq, &seq, seq + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+ * Replace the shared rules after claim(seq) succeeded.
+ */
+static void publish(const tz_rules *rules, uint32_t seq) {
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  _rules = *rules;
+  __atomic_store_n(&_rules_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+bool set(const char *tz) {
+  tz_rules r  = {};
+  bool     ok = tz != nullptr && parse(tz, &r);
+  if (ok) {
+    r.valid = true;
+    // Empty cache
+    r.cache_from  = 1;
+    r.cache_until = 0;
+  } else {
+    r = {};
+  }
+
+  uint32_t seq;
+  do {
+    seq = __atomic_load_n(&_rules_seq, __ATOMIC_RELAXED);
+  } while (!claim(seq));
+  publish(&r, seq);
+  return ok;
+}
+
+bool isset(void) {
+  tz_rules r;
+  load(&r);
+  return r.valid;
+}
+
+/**
+ * Same as offset(), but also tells whether valid rules are set.
+ */
+static long lookup(time_t utc, int *isdst, bool *valid) {
+  tz_rules r;
+  uint32_t seq = load(&r);
+  *valid       = r.valid;
+  if (!r.valid || !r.has_dst) {
+    if (isdst)
+      *isdst = 0;
+    return r.valid ? r.std_offset : 0;
+  }
+
+  if (utc < r.cache_from || utc >= r.cache_until) {
+    update_cache(&r, utc);
+    // Keep it for the next callers, unless the rules changed meanwhile or another task is publishing
+    if (claim(seq))
+      publish(&r, seq);
+  }
+
+  if (isdst)
+    *isdst = r.cache_isdst;
+  return r.cache_offset;
+}
+
+long offset(time_t utc, int *isdst) {
+  bool valid;
+  return lookup(utc, isdst, &valid);
+}
+
+struct tm *localtime_r(const time_t *timer, struct tm *result) {
+  int  isdst;
+  bool valid;
+  long off = lookup(*timer, &isdst, &valid);
+  if (!valid)
+    return nullptr;
+
+  pftime_civil::to_tm(*timer + off, result);
+  result->tm_isdst = isdst;
+  return result;
+}
+
+} // namespace pftime_tz
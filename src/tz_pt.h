@@ -0,0 +1,42 @@
+#ifndef ESPPERFECTTIME_TZ_H_
+#define ESPPERFECTTIME_TZ_H_
+
+#include <time.h>
+#include "ESPPerfectTime.h"
+
+namespace pftime_tz {
+
+/**
+ * Parse a POSIX-style TZ string (e.g. "EST5EDT,M3.2.0,M11.1.0") and
+ * use it for following conversions.
+ *
+ * @param tz TZ string in RAM (null pointer to forget the rules)
+ * @return true when success. If failed, the rules are forgotten.
+ */
+bool set(const char *tz);
+
+/**
+ * Whether valid rules are set by set().
+ */
+bool isset(void);
+
+/**
+ * Get the local time offset from UTC (in seconds, positive to east)
+ * which is effective at given UNIX time.
+ * This is O(1) until the next DST transition, and safe to call from any task.
+ *
+ * @param utc   UNIX time
+ * @param isdst 1 if DST is in effect, otherwise 0 (can be null pointer)
+ */
+long offset(time_t utc, int *isdst);
+
+/**
+ * Same as localtime_r(), but uses the rules parsed by set().
+ *
+ * @return result, or null pointer if no valid rules are set
+ */
+struct tm *localtime_r(const time_t *timer, struct tm *result);
+
+} // namespace pftime_tz
+
+#endif // ESPPERFECTTIME_TZ_H_
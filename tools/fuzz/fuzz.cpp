@@ -0,0 +1,218 @@
+/**
+ * Fuzzes the packet handling of the SNTP client (recv(), recv_check() and process() in
+ * src/sntp_pt.cpp) and of the server mode, on the stubbed lwIP of tools/host.
+ *
+ * Build with libFuzzer (clang):
+ *   clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -Itools/host -Isrc tools/fuzz/fuzz.cpp \
+ *     tools/host/lwip.cpp src/sntp_pt.cpp src/hold_pt.cpp src/rec_pt.cpp -o fuzz
+ *   ./fuzz tools/fuzz/corpus
+ *
+ * Or without libFuzzer, to replay inputs (e.g. the corpus, or a crash) as a regression test:
+ *   g++ -std=c++11 -g -DFUZZ_STANDALONE -fsanitize=address,undefined -Itools/host -Isrc tools/fuzz/fuzz.cpp \
+ *     tools/host/lwip.cpp src/sntp_pt.cpp src/hold_pt.cpp src/rec_pt.cpp -o fuzz
+ *   ./fuzz tools/fuzz/corpus/[a-z]*
+ *
+ * An input is a config byte followed by records of packets delivered in order:
+ *   config   bit 0: interleaved mode, bit 1: broadcast (listen-only) mode, bit 2: server mode on port 123
+ *   record   flags, wait, length, then length bytes of the packet (truncated at the end of the input)
+ *     flags  bits 0-1: 0 from the server to the client, 1 from another host to the client,
+ *                      2 from the server to port 123 (a broadcast, or a request to the server mode),
+ *                      3 from another host (port 50000) to port 123
+ *            bit 2:    copy the transmit timestamp of the last request into the originate timestamp
+ *            bit 3:    copy the receive timestamp of the last request into the originate timestamp
+ *            bits 4-7: split the packet into a pbuf chain of segments of this many bytes (0: a single pbuf)
+ *     wait   16 ms steps of virtual time to run the timers of the client for, before the packet
+ *
+ * Aborts when a pbuf leaks.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+#include <sntp_pt.h>
+#include <lwip/dns.h>
+#include <lwip/timeouts.h>
+#include <lwip/udp.h>
+
+#define USECS_PER_SEC  1000000LL
+// 2020-01-01 00:00:00 UTC, the system clock at the start of each input
+#define FUZZ_START_UTC 1577836800LL
+#define FUZZ_SERVER    "10.0.0.1"
+#define FUZZ_OTHER     "10.0.0.9"
+#define FUZZ_MAX_PACKETS 16
+
+/* ---- the stubs the client needs ---- */
+
+static uint32_t _rand_state;
+static int64_t  _clock_us;
+static uint64_t _clock_up;
+static uint8_t  _leap_indicator;
+
+u32_t host_rand(void) {
+  // Deterministic for each input
+  _rand_state = _rand_state * 1103515245 + 12345;
+  return _rand_state >> 8;
+}
+
+uint64_t micros64(void) {
+  return (uint64_t)sys_now() * 1000;
+}
+
+void host_get_time_us(uint32_t *sec, uint32_t *us) {
+  int64_t now = _clock_us + (int64_t)(micros64() - _clock_up);
+  *sec = (uint32_t)(now / USECS_PER_SEC);
+  *us  = (uint32_t)(now % USECS_PER_SEC);
+}
+
+void host_set_time_us(uint32_t sec, uint32_t us, uint8_t li) {
+  _clock_us       = (int64_t)sec * USECS_PER_SEC + us;
+  _clock_up       = micros64();
+  _leap_indicator = li;
+}
+
+int pftime::gettimeofday(struct timeval *tv, struct timezone *unused) {
+  (void)unused;
+  uint32_t sec, us;
+  host_get_time_us(&sec, &us);
+  tv->tv_sec  = (time_t)sec;
+  tv->tv_usec = (suseconds_t)us;
+  return 0;
+}
+
+uint8_t pftime::getLeapIndicator(void) {
+  return _leap_indicator;
+}
+
+err_t host_dns_lookup(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg, u8_t dns_addrtype) {
+  (void)found;
+  (void)callback_arg;
+  if (dns_addrtype == LWIP_DNS_ADDRTYPE_IPV6 || !ipaddr_aton(hostname, addr))
+    return ERR_VAL;
+  return ERR_OK;
+}
+
+/* ---- the last request of the client ---- */
+
+static struct udp_pcb *_client_pcb;
+static uint8_t         _request[48];
+
+void host_udp_sent(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst, u16_t port) {
+  (void)dst;
+  // Only the requests of the client, not the responses of the server mode
+  if (port != 123 || p->tot_len < 48 || (pbuf_get_at(p, 0) & 0x07) != 3)
+    return;
+  _client_pcb = pcb;
+  memset(_request, 0, sizeof(_request));
+  pbuf_copy_partial(p, _request, sizeof(_request), 0);
+}
+
+/* ---- the fuzzer ---- */
+
+static void reset(uint8_t config) {
+  pftime_sntp::stopserver();
+  pftime_sntp::stop();
+  host_timers_clear();
+
+  _rand_state     = 1;
+  _clock_us       = FUZZ_START_UTC * USECS_PER_SEC;
+  _clock_up       = micros64();
+  _leap_indicator = LI_NO_WARNING;
+  _client_pcb     = nullptr;
+  memset(_request, 0, sizeof(_request));
+
+  pftime_sntp::setservername(0, FUZZ_SERVER);
+  pftime_sntp::setinterleaved((config & 0x01) != 0);
+  pftime_sntp::setoperatingmode((config & 0x02) != 0 ? 1 /* SNTP_OPMODE_LISTENONLY */ : 0 /* SNTP_OPMODE_POLL */);
+  pftime_sntp::setjitter(0, 0);
+  pftime_sntp::init();
+  if ((config & 0x04) != 0)
+    pftime_sntp::startserver(123);
+
+  // Until the first request is sent
+  host_run_until(sys_now() + 1000);
+}
+
+static struct pbuf *make_chain(const uint8_t *data, u16_t len, u16_t segment) {
+  host_pbuf_pool_size = segment;
+  struct pbuf *p      = pbuf_alloc(PBUF_TRANSPORT, len, segment > 0 ? PBUF_POOL : PBUF_RAM);
+  host_pbuf_pool_size = 512;
+  if (p != nullptr)
+    pbuf_take(p, data, len);
+  return p;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size < 1)
+    return 0;
+  reset(data[0]);
+
+  ip_addr_t server, other;
+  ipaddr_aton(FUZZ_SERVER, &server);
+  ipaddr_aton(FUZZ_OTHER, &other);
+
+  size_t pos = 1;
+  for (int n = 0; n < FUZZ_MAX_PACKETS && pos + 3 <= size; n++) {
+    uint8_t flags = data[pos];
+    uint8_t wait  = data[pos + 1];
+    size_t  len   = data[pos + 2];
+    pos += 3;
+    if (len > size - pos)
+      len = size - pos;
+
+    uint8_t packet[255];
+    memcpy(packet, data + pos, len);
+    pos += len;
+
+    host_run_until(sys_now() + wait * 16U);
+
+    if (len >= 32 && (flags & 0x04) != 0)
+      memcpy(packet + 24, _request + 40, 8);
+    else if (len >= 32 && (flags & 0x08) != 0)
+      memcpy(packet + 24, _request + 32, 8);
+
+    struct pbuf *p = make_chain(packet, (u16_t)len, (u16_t)(flags >> 4));
+    if (p == nullptr)
+      continue;
+    const ip_addr_t *src = (flags & 0x01) == 0 ? &server : &other;
+    if ((flags & 0x02) == 0 && _client_pcb != nullptr)
+      host_udp_deliver(_client_pcb, p, src, 123);
+    else if ((flags & 0x02) != 0)
+      host_udp_deliver(nullptr, p, src, (flags & 0x01) == 0 ? 123 : 50000);
+    else
+      pbuf_free(p);
+
+    // Events the client queued for the caller
+    pftime_sntp::dispatch();
+  }
+
+  pftime_sntp::stopserver();
+  pftime_sntp::stop();
+  host_timers_clear();
+  if (host_pbuf_count != 0) {
+    fprintf(stderr, "%d pbufs leaked\n", host_pbuf_count);
+    abort();
+  }
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char **argv) {
+  static uint8_t buf[65536];
+  for (int i = 1; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (f == nullptr) {
+      perror(argv[i]);
+      return 1;
+    }
+    size_t size = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(buf, size);
+  }
+  fprintf(stderr, "%d inputs ok\n", argc - 1);
+  return 0;
+}
+#endif // FUZZ_STANDALONE
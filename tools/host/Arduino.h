@@ -0,0 +1,26 @@
+#ifndef ESPPERFECTTIME_HOST_ARDUINO_H_
+#define ESPPERFECTTIME_HOST_ARDUINO_H_
+
+// Just enough of Arduino.h to build the SNTP client on the host, driven by a harness (tools/sim, tools/fuzz)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define IRAM_ATTR
+#define ICACHE_FLASH_ATTR
+
+/** The monotonic counter (uptime in microseconds), kept by the harness */
+uint64_t micros64(void);
+
+/** The system clock of the device is the virtual clock of the harness */
+void host_get_time_us(uint32_t *sec, uint32_t *us);
+void host_set_time_us(uint32_t sec, uint32_t us, uint8_t li);
+
+#define SNTP_GET_SYSTEM_TIME_US(sec, us)     host_get_time_us(&(sec), &(us))
+#define SNTP_SET_SYSTEM_TIME_US(sec, us, li) host_set_time_us((sec), (us), (li))
+
+#endif // ESPPERFECTTIME_HOST_ARDUINO_H_
@@ -0,0 +1,32 @@
+#ifndef ESPPERFECTTIME_HOST_ARCH_CC_H_
+#define ESPPERFECTTIME_HOST_ARCH_CC_H_
+
+#include <stdint.h>
+
+typedef uint8_t  u8_t;
+typedef int8_t   s8_t;
+typedef uint16_t u16_t;
+typedef int16_t  s16_t;
+typedef uint32_t u32_t;
+typedef int32_t  s32_t;
+typedef uint64_t u64_t;
+typedef int64_t  s64_t;
+
+#define U16_F "u"
+#define S16_F "d"
+#define U32_F "u"
+#define S32_F "d"
+
+#define PACK_STRUCT_BEGIN
+#define PACK_STRUCT_END
+#define PACK_STRUCT_STRUCT __attribute__((packed))
+#define PACK_STRUCT_FIELD(x) x
+
+#define LWIP_UNUSED_ARG(x) (void)(x)
+#define LWIP_ASSERT(message, assertion)
+
+/** The harness seeds this, so that runs are reproducible */
+u32_t host_rand(void);
+#define LWIP_RAND() host_rand()
+
+#endif // ESPPERFECTTIME_HOST_ARCH_CC_H_
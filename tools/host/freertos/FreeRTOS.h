@@ -0,0 +1,14 @@
+#ifndef ESPPERFECTTIME_HOST_FREERTOS_H_
+#define ESPPERFECTTIME_HOST_FREERTOS_H_
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+
+#define pdTRUE            1
+#define pdFALSE           0
+#define portMAX_DELAY     0xFFFFFFFFUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif // ESPPERFECTTIME_HOST_FREERTOS_H_
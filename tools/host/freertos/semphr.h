@@ -0,0 +1,19 @@
+#ifndef ESPPERFECTTIME_HOST_SEMPHR_H_
+#define ESPPERFECTTIME_HOST_SEMPHR_H_
+
+#include <freertos/FreeRTOS.h>
+
+// Single-threaded: taking an empty semaphore fails at once instead of blocking
+
+typedef struct {
+  int count;
+} StaticSemaphore_t;
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer);
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer);
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t sem);
+void              vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#endif // ESPPERFECTTIME_HOST_SEMPHR_H_
@@ -0,0 +1,371 @@
+/**
+ * Host implementation of the parts of lwIP (and FreeRTOS) used by the SNTP client (src/sntp_pt.cpp),
+ * on a virtual clock: timers run only in host_run_until(), in the order they are due.
+ * The network (host_udp_sent(), host_dns_lookup()) and the system clock are left to the harness.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lwip/dns.h>
+#include <lwip/igmp.h>
+#include <lwip/tcpip.h>
+#include <lwip/timeouts.h>
+#include <lwip/udp.h>
+#include <freertos/semphr.h>
+
+#define HOST_MAX_TIMERS 64
+#define HOST_MAX_PCBS   8
+
+const ip_addr_t  ip_addr_any  = {{0, 0, 0, 0}, IPADDR_TYPE_ANY};
+const ip4_addr_t ip4_addr_any = {0};
+
+u16_t host_pbuf_pool_size = 512;
+int   host_pbuf_count;
+
+/* ---- addresses ---- */
+
+int ipaddr_aton(const char *cp, ip_addr_t *addr) {
+  unsigned a, b, c, d;
+  char     tail;
+  memset(addr, 0, sizeof(*addr));
+  if (strncmp(cp, "v6:", 3) == 0) {
+    addr->type    = IPADDR_TYPE_V6;
+    addr->addr[3] = htonl((u32_t)strtoul(cp + 3, nullptr, 10));
+    return 1;
+  }
+  if (sscanf(cp, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+    return 0;
+  addr->type    = IPADDR_TYPE_V4;
+  addr->addr[0] = htonl((a << 24) | (b << 16) | (c << 8) | d);
+  return 1;
+}
+
+char *ipaddr_ntoa(const ip_addr_t *addr) {
+  static char buf[48];
+  if (IP_IS_V6(addr)) {
+    snprintf(buf, sizeof(buf), "v6:%u", (unsigned)ntohl(addr->addr[3]));
+  } else {
+    u32_t a = ntohl(addr->addr[0]);
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (unsigned)(a >> 24), (unsigned)(a >> 16) & 0xFF, (unsigned)(a >> 8) & 0xFF, (unsigned)a & 0xFF);
+  }
+  return buf;
+}
+
+/* ---- pbuf ---- */
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type) {
+  (void)layer;
+  u16_t        seg   = type == PBUF_POOL && host_pbuf_pool_size > 0 ? host_pbuf_pool_size : length;
+  struct pbuf *head  = nullptr;
+  struct pbuf *tail  = nullptr;
+  u16_t        left  = length;
+  do {
+    u16_t        len = left < seg ? left : seg;
+    struct pbuf *p   = (struct pbuf *)malloc(sizeof(struct pbuf) + len);
+    if (p == nullptr) {
+      if (head != nullptr)
+        pbuf_free(head);
+      return nullptr;
+    }
+    p->next    = nullptr;
+    p->payload = len > 0 ? (void *)(p + 1) : nullptr;
+    p->len     = len;
+    p->tot_len = left;
+    p->ref     = 1;
+    host_pbuf_count++;
+    if (tail != nullptr)
+      tail->next = p;
+    else
+      head = p;
+    tail = p;
+    left = (u16_t)(left - len);
+  } while (left > 0);
+  return head;
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+  u8_t count = 0;
+  while (p != nullptr) {
+    if (--p->ref > 0)
+      break;
+    struct pbuf *next = p->next;
+    free(p);
+    host_pbuf_count--;
+    count++;
+    p = next;
+  }
+  return count;
+}
+
+void pbuf_ref(struct pbuf *p) {
+  p->ref++;
+}
+
+void pbuf_realloc(struct pbuf *p, u16_t size) {
+  u16_t left = size;
+  while (p != nullptr && size <= p->tot_len) {
+    p->tot_len = left;
+    if (left <= p->len) {
+      p->len = left;
+      if (p->next != nullptr) {
+        pbuf_free(p->next);
+        p->next = nullptr;
+      }
+      return;
+    }
+    left = (u16_t)(left - p->len);
+    p    = p->next;
+  }
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+  u16_t copied = 0;
+  for (; p != nullptr && copied < len; p = p->next) {
+    if (offset >= p->len) {
+      offset = (u16_t)(offset - p->len);
+      continue;
+    }
+    u16_t n = (u16_t)(p->len - offset);
+    if (n > len - copied)
+      n = (u16_t)(len - copied);
+    memcpy((u8_t *)dataptr + copied, (const u8_t *)p->payload + offset, n);
+    copied = (u16_t)(copied + n);
+    offset = 0;
+  }
+  return copied;
+}
+
+void *pbuf_get_contiguous(const struct pbuf *p, void *buffer, size_t bufsize, u16_t len, u16_t offset) {
+  for (; p != nullptr; p = p->next) {
+    if (offset < p->len)
+      break;
+    offset = (u16_t)(offset - p->len);
+  }
+  if (p == nullptr || p->tot_len < offset + len)
+    return nullptr;
+  if (offset + len <= p->len)
+    return (u8_t *)p->payload + offset;
+  if (buffer == nullptr || bufsize < len)
+    return nullptr;
+  return pbuf_copy_partial(p, buffer, len, offset) == len ? buffer : nullptr;
+}
+
+err_t pbuf_take(struct pbuf *buf, const void *dataptr, u16_t len) {
+  if (buf == nullptr || buf->tot_len < len)
+    return ERR_ARG;
+  u16_t done = 0;
+  for (struct pbuf *p = buf; p != nullptr && done < len; p = p->next) {
+    u16_t n = p->len < len - done ? p->len : (u16_t)(len - done);
+    memcpy(p->payload, (const u8_t *)dataptr + done, n);
+    done = (u16_t)(done + n);
+  }
+  return ERR_OK;
+}
+
+u8_t pbuf_get_at(const struct pbuf *p, u16_t offset) {
+  u8_t b = 0;
+  pbuf_copy_partial(p, &b, 1, offset);
+  return b;
+}
+
+/* ---- timers ---- */
+
+struct host_timer {
+  u32_t               due;
+  u32_t               seq; // keeps the order of timers due at once
+  sys_timeout_handler handler;
+  void               *arg;
+};
+
+static struct host_timer _timers[HOST_MAX_TIMERS];
+static int               _timer_count;
+static u32_t             _timer_seq;
+static u32_t             _now_ms;
+
+void sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg) {
+  if (_timer_count == HOST_MAX_TIMERS) {
+    fprintf(stderr, "host: too many timers\n");
+    abort();
+  }
+  _timers[_timer_count].due     = _now_ms + msecs;
+  _timers[_timer_count].seq     = _timer_seq++;
+  _timers[_timer_count].handler = handler;
+  _timers[_timer_count].arg     = arg;
+  _timer_count++;
+}
+
+void sys_untimeout(sys_timeout_handler handler, void *arg) {
+  // Like lwIP, only the first one matching
+  for (int i = 0; i < _timer_count; i++) {
+    if (_timers[i].handler == handler && _timers[i].arg == arg) {
+      _timers[i] = _timers[--_timer_count];
+      return;
+    }
+  }
+}
+
+u32_t sys_now(void) {
+  return _now_ms;
+}
+
+void host_run_until(u32_t ms) {
+  for (;;) {
+    int next = -1;
+    for (int i = 0; i < _timer_count; i++) {
+      if ((s32_t)(_timers[i].due - ms) > 0)
+        continue;
+      if (next < 0 || (s32_t)(_timers[i].due - _timers[next].due) < 0 ||
+          (_timers[i].due == _timers[next].due && (s32_t)(_timers[i].seq - _timers[next].seq) < 0))
+        next = i;
+    }
+    if (next < 0)
+      break;
+    struct host_timer t = _timers[next];
+    _timers[next]       = _timers[--_timer_count];
+    if ((s32_t)(t.due - _now_ms) > 0)
+      _now_ms = t.due;
+    t.handler(t.arg);
+  }
+  _now_ms = ms;
+}
+
+bool host_next_timer(u32_t *due) {
+  for (int i = 0; i < _timer_count; i++) {
+    if (i == 0 || (s32_t)(_timers[i].due - *due) < 0)
+      *due = _timers[i].due;
+  }
+  return _timer_count > 0;
+}
+
+void host_timers_clear(void) {
+  _timer_count = 0;
+}
+
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx) {
+  sys_timeout(0, function, ctx);
+  return ERR_OK;
+}
+
+/* ---- udp ---- */
+
+static struct udp_pcb *_pcbs[HOST_MAX_PCBS];
+
+struct udp_pcb *udp_new(void) {
+  for (int i = 0; i < HOST_MAX_PCBS; i++) {
+    if (_pcbs[i] == nullptr) {
+      _pcbs[i] = (struct udp_pcb *)calloc(1, sizeof(struct udp_pcb));
+      return _pcbs[i];
+    }
+  }
+  return nullptr;
+}
+
+struct udp_pcb *udp_new_ip_type(u8_t type) {
+  (void)type;
+  return udp_new();
+}
+
+void udp_remove(struct udp_pcb *pcb) {
+  for (int i = 0; i < HOST_MAX_PCBS; i++) {
+    if (_pcbs[i] == pcb) {
+      free(pcb);
+      _pcbs[i] = nullptr;
+    }
+  }
+}
+
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port) {
+  (void)ipaddr;
+  for (int i = 0; i < HOST_MAX_PCBS; i++) {
+    if (port != 0 && _pcbs[i] != nullptr && _pcbs[i] != pcb && _pcbs[i]->local_port == port)
+      return ERR_USE;
+  }
+  pcb->local_port = port;
+  return ERR_OK;
+}
+
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg) {
+  pcb->recv     = recv;
+  pcb->recv_arg = recv_arg;
+}
+
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port) {
+  host_udp_sent(pcb, p, dst_ip, dst_port);
+  return ERR_OK;
+}
+
+void host_udp_deliver(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *src, u16_t src_port) {
+  if (pcb == nullptr) {
+    // to the pcb bound to the port (only SNTP broadcasts are delivered this way)
+    for (int i = 0; i < HOST_MAX_PCBS && pcb == nullptr; i++) {
+      if (_pcbs[i] != nullptr && _pcbs[i]->local_port == 123)
+        pcb = _pcbs[i];
+    }
+  } else {
+    // the pcb may have been removed while the packet was in flight
+    bool found = false;
+    for (int i = 0; i < HOST_MAX_PCBS; i++)
+      found = found || _pcbs[i] == pcb;
+    if (!found)
+      pcb = nullptr;
+  }
+  if (pcb == nullptr || pcb->recv == nullptr) {
+    pbuf_free(p);
+    return;
+  }
+  pcb->recv(pcb->recv_arg, pcb, p, src, src_port);
+}
+
+/* ---- dns ---- */
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg) {
+  return host_dns_lookup(hostname, addr, found, callback_arg, LWIP_DNS_ADDRTYPE_IPV4);
+}
+
+err_t dns_gethostbyname_addrtype(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg, u8_t dns_addrtype) {
+  return host_dns_lookup(hostname, addr, found, callback_arg, dns_addrtype);
+}
+
+/* ---- igmp ---- */
+
+err_t igmp_joingroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr) {
+  (void)ifaddr;
+  (void)groupaddr;
+  return ERR_OK;
+}
+
+err_t igmp_leavegroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr) {
+  (void)ifaddr;
+  (void)groupaddr;
+  return ERR_OK;
+}
+
+/* ---- FreeRTOS ---- */
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+  buffer->count = 1;
+  return buffer;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) {
+  buffer->count = 0;
+  return buffer;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  (void)ticks;
+  if (sem->count == 0)
+    return pdFALSE;
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  sem->count = 1;
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  (void)sem;
+}
@@ -0,0 +1,8 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_DEF_H_
+#define ESPPERFECTTIME_HOST_LWIP_DEF_H_
+
+#include <arpa/inet.h>
+#include <arch/cc.h>
+#include <lwip/opt.h>
+
+#endif // ESPPERFECTTIME_HOST_LWIP_DEF_H_
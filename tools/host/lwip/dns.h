@@ -0,0 +1,22 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_DNS_H_
+#define ESPPERFECTTIME_HOST_LWIP_DNS_H_
+
+#include <lwip/ip_addr.h>
+
+#define LWIP_DNS_ADDRTYPE_IPV4      0
+#define LWIP_DNS_ADDRTYPE_IPV6      1
+#define LWIP_DNS_ADDRTYPE_IPV4_IPV6 2
+#define LWIP_DNS_ADDRTYPE_IPV6_IPV4 3
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
+err_t dns_gethostbyname_addrtype(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg, u8_t dns_addrtype);
+
+/**
+ * Implemented by the harness: resolve hostname to the family. Return ERR_OK with addr,
+ * an error, or ERR_INPROGRESS and call found later.
+ */
+err_t host_dns_lookup(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg, u8_t dns_addrtype);
+
+#endif // ESPPERFECTTIME_HOST_LWIP_DNS_H_
@@ -0,0 +1,17 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_ERR_H_
+#define ESPPERFECTTIME_HOST_LWIP_ERR_H_
+
+#include <arch/cc.h>
+
+typedef s8_t err_t;
+
+#define ERR_OK         0
+#define ERR_MEM        -1
+#define ERR_BUF        -2
+#define ERR_TIMEOUT    -3
+#define ERR_INPROGRESS -5
+#define ERR_VAL        -6
+#define ERR_USE        -8
+#define ERR_ARG        -16
+
+#endif // ESPPERFECTTIME_HOST_LWIP_ERR_H_
@@ -0,0 +1,9 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_IGMP_H_
+#define ESPPERFECTTIME_HOST_LWIP_IGMP_H_
+
+#include <lwip/ip_addr.h>
+
+err_t igmp_joingroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr);
+err_t igmp_leavegroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr);
+
+#endif // ESPPERFECTTIME_HOST_LWIP_IGMP_H_
@@ -0,0 +1,8 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_INIT_H_
+#define ESPPERFECTTIME_HOST_LWIP_INIT_H_
+
+#include <lwip/opt.h>
+
+#define LWIP_VERSION_MAJOR 2
+
+#endif // ESPPERFECTTIME_HOST_LWIP_INIT_H_
@@ -0,0 +1,51 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_IP_ADDR_H_
+#define ESPPERFECTTIME_HOST_LWIP_IP_ADDR_H_
+
+#include <string.h>
+#include <arch/cc.h>
+#include <lwip/def.h>
+#include <lwip/err.h>
+
+typedef struct {
+  u32_t addr;
+} ip4_addr_t;
+
+typedef struct {
+  u32_t addr[4];
+} ip6_addr_t;
+
+/** IPv4 addresses are stored in addr[0] (network byte order) */
+typedef struct {
+  u32_t addr[4];
+  u8_t  type;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4  0U
+#define IPADDR_TYPE_V6  6U
+#define IPADDR_TYPE_ANY 46U
+
+#define IP_GET_TYPE(ipaddr) ((ipaddr)->type)
+#define IP_IS_V4(ipaddr)    ((ipaddr)->type == IPADDR_TYPE_V4)
+#define IP_IS_V6(ipaddr)    ((ipaddr)->type == IPADDR_TYPE_V6)
+#define ip_2_ip4(ipaddr)    ((const ip4_addr_t *)(const void *)(ipaddr)->addr)
+#define ip_2_ip6(ipaddr)    ((const ip6_addr_t *)(const void *)(ipaddr)->addr)
+#define ip4_addr_get_u32(a) ((a)->addr)
+
+#define ip_addr_set(dest, src)      (*(dest) = *(src))
+#define ip_addr_copy(dest, src)     ((dest) = (src))
+#define ip_addr_set_any(is_v6, a)   (memset((a), 0, sizeof(ip_addr_t)), (a)->type = (is_v6) ? IPADDR_TYPE_V6 : IPADDR_TYPE_V4)
+#define ip_addr_cmp(a, b)           ((a)->type == (b)->type && memcmp((a)->addr, (b)->addr, sizeof((a)->addr)) == 0)
+#define ip_addr_isany(a)            ((a)->addr[0] == 0 && (a)->addr[1] == 0 && (a)->addr[2] == 0 && (a)->addr[3] == 0)
+#define ip_addr_ismulticast(a)      (IP_IS_V4(a) ? (ntohl((a)->addr[0]) & 0xF0000000UL) == 0xE0000000UL : ((a)->addr[0] & 0xFF) == 0xFF)
+
+extern const ip_addr_t  ip_addr_any;
+extern const ip4_addr_t ip4_addr_any;
+#define IP_ADDR_ANY   (&ip_addr_any)
+#define IP_ANY_TYPE   (&ip_addr_any)
+#define IP4_ADDR_ANY4 (&ip4_addr_any)
+
+/** Only dotted IPv4 and "v6:<n>" (the IPv6 address ::n) are understood */
+int   ipaddr_aton(const char *cp, ip_addr_t *addr);
+char *ipaddr_ntoa(const ip_addr_t *addr);
+
+#endif // ESPPERFECTTIME_HOST_LWIP_IP_ADDR_H_
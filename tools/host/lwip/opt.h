@@ -0,0 +1,11 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_OPT_H_
+#define ESPPERFECTTIME_HOST_LWIP_OPT_H_
+
+// A dual-stack lwIP with DNS and IGMP, like the ESP32 core
+
+#define LWIP_IPV4 1
+#define LWIP_IPV6 1
+#define LWIP_DNS  1
+#define LWIP_IGMP 1
+
+#endif // ESPPERFECTTIME_HOST_LWIP_OPT_H_
@@ -0,0 +1,33 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_PBUF_H_
+#define ESPPERFECTTIME_HOST_LWIP_PBUF_H_
+
+#include <stddef.h>
+#include <lwip/err.h>
+
+struct pbuf {
+  struct pbuf *next;
+  void        *payload;
+  u16_t        tot_len;
+  u16_t        len;
+  u16_t        ref;
+};
+
+typedef enum { PBUF_TRANSPORT, PBUF_RAW } pbuf_layer;
+typedef enum { PBUF_RAM, PBUF_POOL } pbuf_type;
+
+/** PBUF_POOL allocates a chain of small segments, like lwIP's pool */
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+u8_t         pbuf_free(struct pbuf *p);
+void         pbuf_ref(struct pbuf *p);
+void         pbuf_realloc(struct pbuf *p, u16_t size);
+u16_t        pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+void        *pbuf_get_contiguous(const struct pbuf *p, void *buffer, size_t bufsize, u16_t len, u16_t offset);
+err_t        pbuf_take(struct pbuf *buf, const void *dataptr, u16_t len);
+u8_t         pbuf_get_at(const struct pbuf *p, u16_t offset);
+
+/** Segment size of PBUF_POOL chains */
+extern u16_t host_pbuf_pool_size;
+/** Number of pbufs not freed yet, to check for leaks */
+extern int host_pbuf_count;
+
+#endif // ESPPERFECTTIME_HOST_LWIP_PBUF_H_
@@ -0,0 +1,11 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_TCPIP_H_
+#define ESPPERFECTTIME_HOST_LWIP_TCPIP_H_
+
+#include <lwip/err.h>
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+/** Runs fn as a timer due now */
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx);
+
+#endif // ESPPERFECTTIME_HOST_LWIP_TCPIP_H_
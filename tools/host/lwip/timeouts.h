@@ -0,0 +1,19 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_TIMEOUTS_H_
+#define ESPPERFECTTIME_HOST_LWIP_TIMEOUTS_H_
+
+#include <arch/cc.h>
+
+typedef void (*sys_timeout_handler)(void *arg);
+
+void  sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg);
+void  sys_untimeout(sys_timeout_handler handler, void *arg);
+u32_t sys_now(void);
+
+/** Run the timers (and tcpip_callback()s) due until the virtual time of ms */
+void host_run_until(u32_t ms);
+/** Get the virtual time the earliest timer is due (false if none) */
+bool host_next_timer(u32_t *due);
+/** Drop all the timers */
+void host_timers_clear(void);
+
+#endif // ESPPERFECTTIME_HOST_LWIP_TIMEOUTS_H_
@@ -0,0 +1,28 @@
+#ifndef ESPPERFECTTIME_HOST_LWIP_UDP_H_
+#define ESPPERFECTTIME_HOST_LWIP_UDP_H_
+
+#include <lwip/ip_addr.h>
+#include <lwip/pbuf.h>
+
+struct udp_pcb;
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+struct udp_pcb {
+  u16_t       local_port;
+  udp_recv_fn recv;
+  void       *recv_arg;
+};
+
+struct udp_pcb *udp_new(void);
+struct udp_pcb *udp_new_ip_type(u8_t type);
+void            udp_remove(struct udp_pcb *pcb);
+err_t           udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+void            udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+err_t           udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port);
+
+/** Implemented by the harness: a packet sent (p is freed by the caller after return) */
+void host_udp_sent(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst, u16_t port);
+/** Deliver a packet to the pcb bound to the port (or to pcb if not nullptr), which takes p */
+void host_udp_deliver(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *src, u16_t src_port);
+
+#endif // ESPPERFECTTIME_HOST_LWIP_UDP_H_
@@ -0,0 +1,14 @@
+#ifndef ESPPERFECTTIME_REPLAY_ARDUINO_H_
+#define ESPPERFECTTIME_REPLAY_ARDUINO_H_
+
+// Just enough of Arduino.h to build the clock modules on the host, driven by the recorded clock
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IRAM_ATTR
+
+/** The monotonic counter, set from each sample by replay.cpp */
+uint64_t micros64(void);
+
+#endif // ESPPERFECTTIME_REPLAY_ARDUINO_H_
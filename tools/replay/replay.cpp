@@ -0,0 +1,136 @@
+/**
+ * Replays samples recorded by pftime::setSampleRecorder() / setSampleSink() through the
+ * clock discipline of this library (src/hold_pt.cpp), to see what the clock would have done.
+ *
+ * Build on the host (override PFTIME_HOLD_* with -D to try other tunings):
+ *   g++ -std=c++11 -O2 -Itools/replay -Isrc tools/replay/replay.cpp src/hold_pt.cpp -o replay
+ *
+ * Usage:
+ *   replay [-i update_delay_ms] [-m] samples.bin
+ *
+ *   samples.bin        sync_sample_t records as written by the device (little-endian, 48 bytes each)
+ *   -i update_delay_ms the update delay the device was running with (default 3600000)
+ *   -m                 replay the samples of SntpClient (measure-only) instead of the default client
+ *
+ * Prints CSV to stdout, one line per sample, and a summary to stderr:
+ *   t4_us        local clock when the response was received
+ *   offset_us    offset measured by the sample
+ *   rtt_us       round-trip delay
+ *   residual_us  error of the corrected clock just before the sample
+ *   freq_ppb     frequency estimate after the sample
+ *   error_us     estimated error just before the sample
+ *   state        clock state just before the sample (CLOCK_STATE_*)
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "ESPPerfectTime.h"
+#include <hold_pt.h>
+
+#define USECS_PER_SEC 1000000LL
+
+static uint64_t _now_us;
+
+uint64_t micros64(void) {
+  return _now_us;
+}
+
+static const char *state_name(uint8_t state) {
+  switch (state) {
+  case CLOCK_STATE_UNSYNCHRONIZED: return "unsynchronized";
+  case CLOCK_STATE_ACQUIRING:      return "acquiring";
+  case CLOCK_STATE_LOCKED:         return "locked";
+  case CLOCK_STATE_HOLDOVER:       return "holdover";
+  case CLOCK_STATE_EXPIRED:        return "expired";
+  default:                         return "?";
+  }
+}
+
+int main(int argc, char **argv) {
+  uint32_t    update_delay = 3600000;
+  bool        measure_only = false;
+  const char *path         = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+      update_delay = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "-m") == 0)
+      measure_only = true;
+    else
+      path = argv[i];
+  }
+  if (path == nullptr) {
+    fprintf(stderr, "Usage: %s [-i update_delay_ms] [-m] samples.bin\n", argv[0]);
+    return 2;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    perror(path);
+    return 1;
+  }
+
+  static_assert(sizeof(pftime::sync_sample_t) == 48, "sync_sample_t must be 48 bytes");
+
+  pftime::sync_sample_t sample;
+  size_t                count = 0, holdover = 0;
+  double                sum_sq = 0;
+  int64_t               max_abs = 0;
+
+  printf("t4_us,server,stratum,offset_us,rtt_us,residual_us,freq_ppb,error_us,state\n");
+  pftime_hold::onstart();
+  while (fread(&sample, sizeof(sample), 1, f) == 1) {
+    if (((sample.flags & SAMPLE_MEASURE_ONLY) != 0) != measure_only)
+      continue;
+
+    int64_t offset, rtt;
+    if (sample.mode == 5) {
+      // broadcast: the propagation delay is unknown here
+      offset = sample.t3_us - sample.t4_us;
+      rtt    = 0;
+    } else {
+      offset = ((sample.t2_us - sample.t1_us) + (sample.t3_us - sample.t4_us)) / 2;
+      rtt    = (sample.t4_us - sample.t1_us) - (sample.t3_us - sample.t2_us);
+    }
+
+    _now_us       = (uint64_t)sample.mono_us;
+    uint8_t state = pftime_hold::check();
+    uint32_t error = pftime_hold::error();
+
+    // What the corrected clock read at t4, compared with the time the sample tells
+    struct timeval tv;
+    tv.tv_sec  = (time_t)(sample.t4_us / USECS_PER_SEC);
+    tv.tv_usec = (suseconds_t)(sample.t4_us % USECS_PER_SEC);
+    pftime_hold::correct(&tv);
+    int64_t corrected = (int64_t)tv.tv_sec * USECS_PER_SEC + tv.tv_usec;
+    int64_t residual  = sample.t4_us + offset - corrected;
+
+    pftime_hold::onsync(offset, rtt, update_delay);
+
+    printf("%lld,%u.%u.%u.%u,%u,%lld,%lld,%lld,%ld,%ld,%s\n",
+      (long long)sample.t4_us,
+      sample.server & 0xff, (sample.server >> 8) & 0xff, (sample.server >> 16) & 0xff, sample.server >> 24,
+      sample.stratum, (long long)offset, (long long)rtt, (long long)residual,
+      (long)pftime_hold::frequency(), error == UINT32_MAX ? -1L : (long)error, state_name(state));
+
+    // The first sample steps the clock from nowhere: leave it out of the statistics
+    if (count > 0) {
+      sum_sq += (double)residual * residual;
+      if (llabs(residual) > max_abs)
+        max_abs = llabs(residual);
+    }
+    if (state == CLOCK_STATE_HOLDOVER || state == CLOCK_STATE_EXPIRED)
+      holdover++;
+    count++;
+  }
+  fclose(f);
+
+  fprintf(stderr, "%zu samples, residual rms %.0f us, max %lld us, %zu in holdover, frequency %ld ppb\n",
+    count, count > 1 ? sqrt(sum_sq / (count - 1)) : 0.0, (long long)max_abs, holdover, (long)pftime_hold::frequency());
+  return 0;
+}
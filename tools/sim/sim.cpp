@@ -0,0 +1,452 @@
+/**
+ * Simulates the SNTP client of this library (src/sntp_pt.cpp and the clock discipline of
+ * src/hold_pt.cpp) against simulated NTP servers on a virtual clock, to evaluate tunings
+ * without waiting for real time to pass.
+ *
+ * The client runs on stubbed lwIP (tools/host): its timers, pbufs and UDP are virtual, and the
+ * system clock of the device is a virtual clock that drifts against the true time.
+ *
+ * Build on the host (override SNTP_* / PFTIME_HOLD_* with -D to try other tunings):
+ *   g++ -std=c++11 -O2 -Itools/host -Isrc tools/sim/sim.cpp tools/host/lwip.cpp \
+ *     src/sntp_pt.cpp src/hold_pt.cpp src/rec_pt.cpp -o sim
+ *
+ * Usage:
+ *   sim [-T hours] [-d ppm] [-i update_delay_ms] [-p period_s] [-t threshold_us] [-l] [-r seed]
+ *       [-s delay_ms,jitter_ms,asym_ms,loss_pct,offset_ms,kod_pct]...
+ *
+ *   -T hours           duration of the simulation (default 24, up to 1000)
+ *   -d ppm             frequency error of the oscillator of the device (default 20)
+ *   -i update_delay_ms the update delay of the client (default SNTP_UPDATE_DELAY)
+ *   -p period_s        period to sample the error of the clock (default 10)
+ *   -t threshold_us    the error the clock has converged within (default 1000)
+ *   -l                 the servers announce a leap second inserted at the end of the first day
+ *   -r seed            seed of the random numbers (default 1)
+ *   -s ...             adds a server (up to SNTP_MAX_SERVERS, tried in order; default 10,2,0,0,0,0):
+ *                        delay_ms   one-way network delay
+ *                        jitter_ms  mean of the random (exponential) extra delay in each direction
+ *                        asym_ms    extra delay of the requests only (an error no client can see)
+ *                        loss_pct   percentage of the packets lost in each direction
+ *                        offset_ms  error of the clock of the server (a falseticker if not 0)
+ *                        kod_pct    percentage of the requests answered with a RATE Kiss-of-Death
+ *
+ * Prints CSV to stdout, one line per period after the first sync, and a summary to stderr:
+ *   time_s       true time since the start
+ *   error_us     what pftime::gettimeofday() would return minus the true UTC
+ *   estimate_us  estimated error of the clock (pftime::getClockError(); -1 if unknown)
+ *   state        clock state (CLOCK_STATE_*)
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <queue>
+#include <vector>
+#include "ESPPerfectTime.h"
+#include <hold_pt.h>
+#include <sntp_pt.h>
+#include <lwip/dns.h>
+#include <lwip/timeouts.h>
+#include <lwip/udp.h>
+
+#define USECS_PER_SEC  1000000LL
+#define NTP_EPOCH_DIFF 2208988800LL
+// 2016-12-31 00:00:00 UTC, the day the last leap second so far was inserted
+#define SIM_START_UTC  1483142400LL
+#define SIM_MAX_SERVERS 8
+
+struct sim_server {
+  double delay_ms;
+  double jitter_ms;
+  double asym_ms;
+  double loss_pct;
+  double offset_ms;
+  double kod_pct;
+};
+
+static struct sim_server _servers[SIM_MAX_SERVERS];
+static int               _server_count;
+
+static double  _drift_ppm = 20;
+static bool    _leap;
+static int64_t _leap_us; // true UTC of 00:00:00 just after the inserted leap second
+
+/* ---- random numbers ---- */
+
+static uint64_t _rand_state = 1;
+
+static uint32_t next_rand(void) {
+  // xorshift64*
+  _rand_state ^= _rand_state >> 12;
+  _rand_state ^= _rand_state << 25;
+  _rand_state ^= _rand_state >> 27;
+  return (uint32_t)((_rand_state * 2685821657736338717ULL) >> 32);
+}
+
+static double uniform(void) {
+  return (next_rand() + 0.5) / 4294967296.0;
+}
+
+u32_t host_rand(void) {
+  return next_rand();
+}
+
+/* ---- time ---- */
+
+// The device counts its uptime with its own oscillator; everything runs on that count
+static uint64_t _uptime_us;
+
+uint64_t micros64(void) {
+  uint64_t now = (uint64_t)sys_now() * 1000;
+  return now > _uptime_us ? now : _uptime_us;
+}
+
+// True time since the start for the uptime of the device
+static double true_us(uint64_t uptime_us) {
+  return uptime_us / (1 + _drift_ppm / 1e6);
+}
+
+// Uptime of the device for a true time since the start
+static uint64_t uptime_at(double true_us) {
+  return (uint64_t)(true_us * (1 + _drift_ppm / 1e6));
+}
+
+// True UTC (in microseconds) for the true time since the start; the inserted leap second
+// repeats 23:59:59, like the servers and pftime::gettimeofday() do
+static int64_t utc_us(double true_us) {
+  int64_t utc = SIM_START_UTC * USECS_PER_SEC + (int64_t)true_us;
+  if (_leap && utc >= _leap_us)
+    utc -= USECS_PER_SEC;
+  return utc;
+}
+
+/* ---- the system clock of the device ---- */
+
+static int64_t  _clock_base_us;   // the clock set last
+static uint64_t _clock_base_up;   // uptime when the clock was set
+static uint8_t  _leap_indicator;
+static time_t   _leap_time;
+static uint32_t _steps;
+
+void host_get_time_us(uint32_t *sec, uint32_t *us) {
+  int64_t now = _clock_base_us + (int64_t)(micros64() - _clock_base_up);
+  *sec = (uint32_t)(now / USECS_PER_SEC);
+  *us  = (uint32_t)(now % USECS_PER_SEC);
+}
+
+void host_set_time_us(uint32_t sec, uint32_t us, uint8_t li) {
+  _clock_base_us  = (int64_t)sec * USECS_PER_SEC + us;
+  _clock_base_up  = micros64();
+  _leap_indicator = li;
+  if (li == LI_LAST_MINUTE_61_SEC || li == LI_LAST_MINUTE_59_SEC) {
+    // the last second of the month, like ESPPerfectTime.cpp
+    time_t    t  = (time_t)sec;
+    struct tm tm = *gmtime(&t);
+    tm.tm_mon++;
+    tm.tm_mday = 1;
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    _leap_time = timegm(&tm) - 1;
+  }
+  _steps++;
+}
+
+static void adjust_leap_sec(time_t *t) {
+  if (_leap_indicator == LI_LAST_MINUTE_61_SEC && *t > _leap_time)
+    (*t)--;
+  else if (_leap_indicator == LI_LAST_MINUTE_59_SEC && *t >= _leap_time)
+    (*t)++;
+}
+
+// What the library reads, without the fast clock
+int pftime::gettimeofday(struct timeval *tv, struct timezone *unused) {
+  (void)unused;
+  uint32_t sec, us;
+  host_get_time_us(&sec, &us);
+  tv->tv_sec  = (time_t)sec;
+  tv->tv_usec = (suseconds_t)us;
+  pftime_hold::correct(tv);
+  adjust_leap_sec(&tv->tv_sec);
+  return 0;
+}
+
+uint8_t pftime::getLeapIndicator(void) {
+  return _leap_indicator;
+}
+
+/* ---- the network and the servers ---- */
+
+struct sim_event {
+  uint64_t        at; // uptime of the device
+  uint32_t        seq;
+  int             server; // -1 for sampling
+  struct udp_pcb *pcb;
+  ip_addr_t       src;
+  uint8_t         data[48];
+
+  bool operator<(const sim_event &other) const {
+    return at != other.at ? at > other.at : seq > other.seq;
+  }
+};
+
+static std::priority_queue<sim_event> _events;
+static uint32_t                       _event_seq;
+static uint32_t                       _lost;
+
+static void push_event(struct sim_event &ev) {
+  ev.seq = _event_seq++;
+  _events.push(ev);
+}
+
+static double net_delay_us(const struct sim_server *s) {
+  return (s->delay_ms - s->jitter_ms * log(uniform())) * 1000;
+}
+
+static void put_ntp_time(uint8_t *p, int64_t utc) {
+  uint32_t sec  = (uint32_t)(utc / USECS_PER_SEC + NTP_EPOCH_DIFF);
+  uint32_t frac = (uint32_t)((utc % USECS_PER_SEC) * 4294967296LL / USECS_PER_SEC);
+  for (int i = 0; i < 4; i++) {
+    p[i]     = (uint8_t)(sec >> (24 - 8 * i));
+    p[i + 4] = (uint8_t)(frac >> (24 - 8 * i));
+  }
+}
+
+void host_udp_sent(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst, u16_t port) {
+  int idx = IP_IS_V4(dst) ? (int)(ntohl(ip_2_ip4(dst)->addr) & 0xff) - 1 : -1;
+  if (idx < 0 || idx >= _server_count || port != 123 || p->tot_len < 48)
+    return;
+  const struct sim_server *s = &_servers[idx];
+
+  uint8_t req[48];
+  pbuf_copy_partial(p, req, sizeof(req), 0);
+  if (uniform() * 100 < s->loss_pct || uniform() * 100 < s->loss_pct) {
+    _lost++;
+    return;
+  }
+
+  // The server receives the request and answers 50 us later
+  double  rx   = true_us(micros64()) + net_delay_us(s) + s->asym_ms * 1000;
+  double  tx   = rx + 50;
+  int64_t skew = (int64_t)(s->offset_ms * 1000);
+
+  struct sim_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.at     = uptime_at(tx + net_delay_us(s));
+  ev.server = idx;
+  ev.pcb    = pcb;
+  ip_addr_copy(ev.src, *dst);
+
+  uint8_t *r = ev.data;
+  if (uniform() * 100 < s->kod_pct) {
+    // Kiss-of-Death: stratum 0 with the code in the reference ID
+    r[0] = (0 << 6) | (4 << 3) | 4;
+    r[1] = 0;
+    memcpy(r + 12, "RATE", 4);
+  } else {
+    // The servers announce the leap second during the last day before it
+    int64_t utc = utc_us(rx);
+    bool    li  = _leap && utc < _leap_us && utc >= _leap_us - 86400 * USECS_PER_SEC;
+    r[0] = (uint8_t)(((li ? LI_LAST_MINUTE_61_SEC : LI_NO_WARNING) << 6) | (4 << 3) | 4);
+    r[1] = 2;
+    memcpy(r + 12, "\xc0\x00\x02\x01", 4);
+    put_ntp_time(r + 16, utc_us(rx) + skew - 16 * USECS_PER_SEC);
+    put_ntp_time(r + 32, utc_us(rx) + skew);
+    put_ntp_time(r + 40, utc_us(tx) + skew);
+  }
+  r[2] = req[2];
+  r[3] = (uint8_t)-20;
+  r[5] = 0x01; // root delay and dispersion of 1/256 s
+  r[9] = 0x01;
+  memcpy(r + 24, req + 40, 8); // originate timestamp
+  push_event(ev);
+}
+
+err_t host_dns_lookup(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg, u8_t dns_addrtype) {
+  (void)found;
+  (void)callback_arg;
+  // The servers are IPv4 only
+  if (dns_addrtype == LWIP_DNS_ADDRTYPE_IPV6 || !ipaddr_aton(hostname, addr) || !IP_IS_V4(addr))
+    return ERR_VAL;
+  return ERR_OK;
+}
+
+/* ---- the report ---- */
+
+struct sim_sample {
+  double  time_s;
+  int64_t error_us;
+};
+
+static std::vector<struct sim_sample> _samples;
+static double                         _first_sync_s = -1;
+static uint32_t                       _syncs, _fails;
+
+static void on_event(const pftime::sync_event_t *event, void *ctx) {
+  (void)ctx;
+  if (event->type == SYNC_EVENT_SUCCESS) {
+    if (_first_sync_s < 0)
+      _first_sync_s = true_us(micros64()) / USECS_PER_SEC;
+    _syncs++;
+  } else {
+    _fails++;
+  }
+}
+
+static void sample(void) {
+  double now = true_us(micros64());
+  if (!pftime_sntp::getstatus()->synced)
+    return;
+
+  struct timeval tv;
+  pftime::gettimeofday(&tv, nullptr);
+  int64_t  error    = (int64_t)tv.tv_sec * USECS_PER_SEC + tv.tv_usec - utc_us(now);
+  uint8_t  state    = pftime_hold::check();
+  uint32_t estimate = pftime_hold::error();
+  printf("%.0f,%lld,%ld,%u\n", now / USECS_PER_SEC, (long long)error,
+    estimate == UINT32_MAX ? -1L : (long)estimate, state);
+  _samples.push_back({now / USECS_PER_SEC, error});
+}
+
+static const char *state_name(uint8_t state) {
+  switch (state) {
+  case CLOCK_STATE_UNSYNCHRONIZED: return "unsynchronized";
+  case CLOCK_STATE_ACQUIRING:      return "acquiring";
+  case CLOCK_STATE_LOCKED:         return "locked";
+  case CLOCK_STATE_HOLDOVER:       return "holdover";
+  case CLOCK_STATE_EXPIRED:        return "expired";
+  default:                         return "?";
+  }
+}
+
+static void report(double threshold_us) {
+  // Converged at the first sample after the last one off by the threshold
+  size_t first = 0;
+  for (size_t i = 0; i < _samples.size(); i++) {
+    if (llabs(_samples[i].error_us) >= threshold_us)
+      first = i + 1;
+  }
+
+  double  sum_sq  = 0;
+  int64_t max_abs = 0;
+  for (size_t i = first; i < _samples.size(); i++) {
+    sum_sq += (double)_samples[i].error_us * _samples[i].error_us;
+    if (llabs(_samples[i].error_us) > max_abs)
+      max_abs = llabs(_samples[i].error_us);
+  }
+
+  if (_first_sync_s < 0)
+    fprintf(stderr, "never synced\n");
+  else if (first == _samples.size())
+    fprintf(stderr, "first sync %.1f s, not converged within %.0f us\n", _first_sync_s, threshold_us);
+  else
+    fprintf(stderr, "first sync %.1f s, converged within %.0f us at %.0f s, then error rms %.0f us, max %lld us\n",
+      _first_sync_s, threshold_us, _samples[first].time_s, sqrt(sum_sq / (_samples.size() - first)), (long long)max_abs);
+
+  const struct pftime_sntp::sntp_stats *stats = pftime_sntp::getstats();
+  fprintf(stderr, "%u requests (%u lost), %u accepted, %u rejected, %u kod; %u syncs, %u fails, %u steps; clock %s\n",
+    stats->requests, _lost, stats->accepted, stats->rejected, stats->kod, _syncs, _fails, _steps,
+    state_name(pftime_hold::check()));
+}
+
+/* ---- main ---- */
+
+static void usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [-T hours] [-d ppm] [-i update_delay_ms] [-p period_s] [-t threshold_us] [-l] [-r seed]\n"
+    "          [-s delay_ms,jitter_ms,asym_ms,loss_pct,offset_ms,kod_pct]...\n",
+    name);
+}
+
+int main(int argc, char **argv) {
+  double   hours        = 24;
+  uint32_t update_delay = 0;
+  double   period_s     = 10;
+  double   threshold_us = 1000;
+  char     names[SIM_MAX_SERVERS][20];
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+      hours = atof(argv[++i]);
+    else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+      _drift_ppm = atof(argv[++i]);
+    else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+      update_delay = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      period_s = atof(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      threshold_us = atof(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0)
+      _leap = true;
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      _rand_state = strtoull(argv[++i], nullptr, 10) | 1;
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && _server_count < SIM_MAX_SERVERS) {
+      struct sim_server *s = &_servers[_server_count++];
+      memset(s, 0, sizeof(*s));
+      sscanf(argv[++i], "%lf,%lf,%lf,%lf,%lf,%lf", &s->delay_ms, &s->jitter_ms, &s->asym_ms, &s->loss_pct, &s->offset_ms, &s->kod_pct);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (hours <= 0 || hours > 1000 || period_s <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (_server_count == 0) {
+    _servers[0]   = {10, 2, 0, 0, 0, 0};
+    _server_count = 1;
+  }
+  _leap_us = (SIM_START_UTC + 86400) * USECS_PER_SEC;
+
+  pftime_sntp::addlistener(on_event, nullptr);
+  for (int i = 0; i < _server_count; i++) {
+    snprintf(names[i], sizeof(names[i]), "10.0.0.%d", i + 1);
+    pftime_sntp::setservername((u8_t)i, names[i]);
+  }
+  if (update_delay != 0)
+    pftime_sntp::set_update_delay(update_delay);
+  pftime_sntp::init();
+
+  // Sample the error of the clock periodically
+  uint64_t end = uptime_at(hours * 3600 * USECS_PER_SEC);
+  for (double t = period_s; t * USECS_PER_SEC <= hours * 3600 * USECS_PER_SEC; t += period_s) {
+    struct sim_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.at     = uptime_at(t * USECS_PER_SEC);
+    ev.server = -1;
+    push_event(ev);
+  }
+
+  printf("time_s,error_us,estimate_us,state\n");
+  for (;;) {
+    // Run the timers of the client due before the next event
+    u32_t due;
+    if (host_next_timer(&due) && (_events.empty() || (uint64_t)due * 1000 <= _events.top().at)) {
+      if ((uint64_t)due * 1000 > end)
+        break;
+      host_run_until(due);
+      continue;
+    }
+    if (_events.empty() || _events.top().at > end)
+      break;
+
+    struct sim_event ev = _events.top();
+    _events.pop();
+    _uptime_us = ev.at;
+    host_run_until((u32_t)(ev.at / 1000));
+    if (ev.server < 0) {
+      sample();
+    } else {
+      struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sizeof(ev.data), PBUF_POOL);
+      pbuf_take(p, ev.data, sizeof(ev.data));
+      host_udp_deliver(ev.pcb, p, &ev.src, 123);
+    }
+  }
+  pftime_sntp::stop();
+
+  report(threshold_us);
+  return 0;
+}
@@ -0,0 +1,112 @@
+#!/bin/bash -eu
+
+# Builds the example under each feature configuration and reports the footprint
+# of this library: flash, IRAM and RAM per section, the largest symbols, and
+# an estimate of the stack used by the receive path (recv -> recv_check/process -> settimeofday).
+#
+# The totals are compared with travis/footprint/$BOARD.txt, and the build fails
+# when any of them grows by more than $TOLERANCE bytes. Without a baseline the job only reports.
+# Run with UPDATE_BASELINE=1 on this toolchain to (re)write the baseline after an intended change,
+# and commit it: numbers from any other compiler would make the comparison meaningless.
+#
+# Usage: BOARD=esp_wroom_02 travis/footprint.sh
+
+BOARD=${BOARD:-esp_wroom_02}
+TOLERANCE=${TOLERANCE:-0}
+UPDATE_BASELINE=${UPDATE_BASELINE:-0}
+
+ROOT=$PWD
+EXAMPLE=$ROOT/examples/Basic/Basic.ino
+BASELINE=$ROOT/travis/footprint/$BOARD.txt
+WORK=$(mktemp -d)
+REPORT=$WORK/report.txt
+
+# name and build flags of each configuration
+CONFIGS=(
+  "default|"
+  "minimal|-DSNTP_SUPPORT_SERVER=0 -DSNTP_SUPPORT_BROADCAST=0 -DSNTP_SUPPORT_INTERLEAVED=0 -DSNTP_EVENT_QUEUE_SIZE=0 -DSNTP_TRACE_SIZE=0"
+)
+
+# functions on the receive path, in the order of the calls
+RECV_PATH="recv recv_check save_server_status process step_system_time set_system_time_us settimeofday notify_sync notify invoke_callback"
+
+command -v platformio > /dev/null || pip install --user platformio
+
+for CONFIG in "${CONFIGS[@]}"; do
+  NAME=${CONFIG%%|*}
+  FLAGS=${CONFIG#*|}
+  DIR=$WORK/$NAME
+
+  platformio ci "$EXAMPLE" -l "$ROOT" -b "$BOARD" --keep-build-dir --build-dir "$DIR" \
+    -O "build_flags=-fstack-usage $FLAGS" > "$WORK/$NAME.log" 2>&1 || {
+    cat "$WORK/$NAME.log"
+    exit 1
+  }
+
+  BUILD=$DIR/.pio/build/$BOARD
+  PREFIX=$(find ~/.platformio/packages -name '*-elf-size' | grep -E "$(
+    case $BOARD in esp32*) echo xtensa-esp32 ;; *) echo xtensa-lx106 ;; esac
+  )" | head -n 1)
+  PREFIX=${PREFIX%size}
+  OBJECTS=$(find "$BUILD" -path '*ESPPerfectTime*' -name '*.o')
+
+  echo "== $NAME ($BOARD) ${FLAGS:-(no flags)}"
+
+  # Section totals of the library objects (before linking, so unused code is included)
+  "${PREFIX}size" -A $OBJECTS | awk -v name="$NAME" '
+    $1 ~ /^\.iram/                          { iram   += $2; next }
+    $1 ~ /^\.(text|irom0|literal|flash)/    { flash  += $2; next }
+    $1 ~ /^\.rodata/                        { rodata += $2; next }
+    $1 ~ /^\.data/                          { data   += $2; next }
+    $1 ~ /^\.bss/                           { bss    += $2; next }
+    END {
+      printf "%s flash %d\n",  name, flash
+      printf "%s iram %d\n",   name, iram
+      printf "%s rodata %d\n", name, rodata
+      printf "%s data %d\n",   name, data
+      printf "%s bss %d\n",    name, bss
+    }' | tee -a "$REPORT"
+
+  # Stack frames of the receive path, summed as if each function called the next one.
+  # Only an estimate: the callbacks of the user, lwIP and the libc are left out,
+  # and functions inlined into their callers have no frame of their own.
+  find "$BUILD" -path '*ESPPerfectTime*' -name '*.su' -exec cat {} + | awk -F '\t' -v name="$NAME" -v path="$RECV_PATH" '
+    BEGIN { n = split(path, fn, " "); for (i = 1; i <= n; i++) want[fn[i]] = 1 }
+    {
+      # file:line:column:signature <TAB> bytes <TAB> qualifier
+      f = $1; sub(/\(.*/, "", f); sub(/.*[: ]/, "", f)
+      if (f in want && $2 + 0 > frame[f]) frame[f] = $2 + 0
+    }
+    END {
+      for (f in frame) { printf "  stack %-20s %5d\n", f, frame[f] > "/dev/stderr"; total += frame[f] }
+      printf "%s recv_stack_estimate %d\n", name, total
+    }' | tee -a "$REPORT"
+
+  # Largest symbols in the final image
+  echo "  largest symbols:"
+  "${PREFIX}nm" -S -C --size-sort --radix=d "$BUILD/firmware.elf" | grep -E 'pftime' | tail -n 15 |
+    awk '{ size = $2 + 0; $1 = $2 = ""; printf "  %6d%s\n", size, $0 }'
+done
+
+if [ "$UPDATE_BASELINE" = 1 ]; then
+  mkdir -p "$(dirname "$BASELINE")"
+  { echo "# Footprint of ESPPerfectTime on $BOARD, written by travis/footprint.sh"; cat "$REPORT"; } > "$BASELINE"
+  echo "Baseline written to $BASELINE"
+  exit 0
+fi
+if [ ! -f "$BASELINE" ]; then
+  echo "No baseline $BASELINE (report only): run with UPDATE_BASELINE=1 and commit it"
+  exit 0
+fi
+
+# Compare with the baseline
+awk -v tolerance="$TOLERANCE" '
+  /^#/      { next }
+  NR == FNR { base[$1 " " $2] = $3; next }
+  ($1 " " $2) in base {
+    diff = $3 - base[$1 " " $2]
+    printf "%-8s %-20s %7d -> %7d (%+d)\n", $1, $2, base[$1 " " $2], $3, diff
+    if (diff > tolerance) failed = 1
+  }
+  END { if (failed) { print "Footprint regression (see above)"; exit 1 } }
+' "$BASELINE" "$REPORT"